@@ -0,0 +1,101 @@
+/*Accuracy/cost curve of the sun detector
+ * on PC: every frame is detected at each
+ * angle step, with and without smoothing
+ * the accumulator, and compared with a
+ * fine 1 degree run of the same frame.
+ * Compile: g++ -O2 -pthread -o benchmark benchmark.cpp
+ * Run: ./benchmark file1.ppm file2.ppm ... */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#define CAMERA_WIDTH 320 //Control Resolution from Camera
+#define CAMERA_HEIGHT 240 //Control Resolution from Camera
+#include "sunDetector.h"
+#include "ppm.h"
+
+// the settings testImage.cpp uses, but for degStep and smoothing
+double convThreshold = 65.0;
+int radiusRange = 0;
+int voteThr = 10;
+int smoothRadius = 1;
+int degSteps[] = {9, 15, 20, 30, 45};
+const char* smoothingNames[] = {"none", "box", "gauss"};
+int repeats = 5; // each frame is timed this many times, the fastest counts
+
+SunDetector sun;
+
+struct Frame {
+    LabelledFrame image;
+    bool found; // by the 1 degree run
+    double x, y;
+};
+
+// detects a frame, returning the fastest of the repeats in ms
+double Detect(Frame& frame, int degStep, VoteSmoothing smoothing, bool& found) {
+    sun.convThreshold = convThreshold;
+    sun.radiusRange = radiusRange;
+    sun.voteThr = voteThr;
+    sun.degStep = degStep;
+    sun.smoothing = smoothing;
+    sun.smoothRadius = smoothRadius;
+    double best = 1e9;
+    for (int i = 0; i < repeats; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        found = sun.Detect(frame.image.pixels.data());
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (ms < best) best = ms;
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s file1.ppm file2.ppm ...\n", argv[0]);
+        return 1;
+    }
+    Logger::Global().level = LEVEL_INFO; // not why each candidate failed
+    std::vector<Frame> frames;
+    int suns = 0;
+    for (int i = 1; i < argc; i++) {
+        Frame frame;
+        if (!ReadPPM(argv[i], frame.image)) continue;
+        if (frame.image.width != CAMERA_WIDTH || frame.image.height != CAMERA_HEIGHT) {
+            printf("'%s' is %dx%d, not %dx%d\n", argv[i], frame.image.width, frame.image.height, CAMERA_WIDTH, CAMERA_HEIGHT);
+            continue;
+        }
+        Detect(frame, 1, SMOOTH_NONE, frame.found);
+        frame.x = sun.centreX/(double)(1 << SUBPIXEL_BITS);
+        frame.y = sun.centreY/(double)(1 << SUBPIXEL_BITS);
+        if (frame.found) suns++;
+        frames.push_back(frame);
+    }
+    printf("%d frames, the sun in %d at 1 degree\n", (int)frames.size(), suns);
+    printf("degStep smoothing  found  false  error(px)  ms/frame\n");
+    for (int degStep : degSteps) {
+        for (int s = SMOOTH_NONE; s <= SMOOTH_GAUSS; s++) {
+            int hits = 0;
+            int falseHits = 0;
+            double error = 0;
+            double ms = 0;
+            for (Frame& frame : frames) {
+                bool found;
+                ms += Detect(frame, degStep, (VoteSmoothing)s, found);
+                if (!found) continue;
+                if (!frame.found) {
+                    falseHits++;
+                    continue;
+                }
+                hits++;
+                error += hypot(sun.centreX/(double)(1 << SUBPIXEL_BITS) - frame.x,
+                               sun.centreY/(double)(1 << SUBPIXEL_BITS) - frame.y);
+            }
+            printf("%7d %-9s %3d/%-3d %5d %10.2f %9.2f\n", degStep, smoothingNames[s], hits, suns,
+                   falseHits, hits ? error/hits : 0.0, frames.empty() ? 0.0 : ms/frames.size());
+        }
+    }
+    return 0;
+}
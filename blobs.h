@@ -0,0 +1,134 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Connected-component labelling of the red mask, so the Hough vote can run on each
+// red blob that could be the sun instead of over the whole frame. Works on runs of
+// set bits in the bitset rows: runs that touch a run in the row above (8-connected)
+// are unioned in the first pass, and the second pass totals each component.
+
+#ifndef BLOBS_H
+#define BLOBS_H
+
+#include <cstdint>
+#include <vector>
+
+#ifndef CAMERA_WIDTH
+#define CAMERA_WIDTH 320 //Control Resolution from Camera
+#define CAMERA_HEIGHT 240 //Control Resolution from Camera
+#endif
+#define MASK_WORDS ((CAMERA_WIDTH+63)/64) // 64-bit words per mask row
+
+struct Blob {
+    int minX, minY, maxX, maxY; // bounding box, inclusive
+    int area;
+    double centroidX, centroidY;
+    double extent; // area over bounding box area, pi/4 for a disc and 1 for a square
+};
+
+class BlobLabeller {
+public:
+    std::vector<Blob> blobs; // results of the last Label()
+
+    // labels the set bits of mask, keeping components of at least minArea pixels
+    void Label(const uint64_t mask[CAMERA_HEIGHT][MASK_WORDS], int minArea);
+
+private:
+    struct Run {
+        short row, start, end; // end is exclusive
+        int parent; // union-find link to another run
+    };
+    std::vector<Run> runs;
+    std::vector<int> blobOf;
+
+    static int NextBit(const uint64_t* row, int from, bool set);
+    int Root(int i);
+};
+
+// column of the first bit at or after from that is set (or clear), CAMERA_WIDTH if none
+inline int BlobLabeller::NextBit(const uint64_t* row, int from, bool set) {
+    int w = from >> 6;
+    if (w >= MASK_WORDS) return CAMERA_WIDTH;
+    uint64_t bits = (set ? row[w] : ~row[w]) & (~0ULL << (from & 63));
+    while (bits == 0) {
+        if (++w >= MASK_WORDS) return CAMERA_WIDTH;
+        bits = set ? row[w] : ~row[w];
+    }
+    int col = w*64 + __builtin_ctzll(bits);
+    return col < CAMERA_WIDTH ? col : CAMERA_WIDTH;
+}
+
+inline int BlobLabeller::Root(int i) {
+    while (runs[i].parent != i) {
+        runs[i].parent = runs[runs[i].parent].parent; // path halving
+        i = runs[i].parent;
+    }
+    return i;
+}
+
+inline void BlobLabeller::Label(const uint64_t mask[CAMERA_HEIGHT][MASK_WORDS], int minArea) {
+    runs.clear();
+    blobs.clear();
+
+    // first pass: runs, joined to the runs they touch in the row above
+    int prevFirst = 0;
+    int prevLast = 0;
+    for (int row = 0; row < CAMERA_HEIGHT; row++) {
+        int first = runs.size();
+        int above = prevFirst;
+        for (int col = NextBit(mask[row], 0, true); col < CAMERA_WIDTH; ) {
+            int end = NextBit(mask[row], col, false);
+            Run run = {(short)row, (short)col, (short)end, (int)runs.size()};
+            runs.push_back(run);
+            int self = runs.size() - 1;
+            // skip runs above that end before this one starts, diagonals count as touching
+            while (above < prevLast && runs[above].end < col) above++;
+            for (int a = above; a < prevLast && runs[a].start <= end; a++) {
+                int ra = Root(a);
+                int rs = Root(self);
+                if (ra < rs) runs[rs].parent = ra;
+                else if (rs < ra) runs[ra].parent = rs;
+            }
+            col = end < CAMERA_WIDTH ? NextBit(mask[row], end, true) : CAMERA_WIDTH;
+        }
+        prevFirst = first;
+        prevLast = runs.size();
+    }
+
+    // second pass: total up each component
+    blobOf.assign(runs.size(), -1);
+    std::vector<double> sumX;
+    std::vector<double> sumY;
+    for (int i = 0; i < (int)runs.size(); i++) {
+        int root = Root(i);
+        if (blobOf[root] < 0) {
+            blobOf[root] = blobs.size();
+            Blob b = {CAMERA_WIDTH, CAMERA_HEIGHT, -1, -1, 0, 0, 0, 0};
+            blobs.push_back(b);
+            sumX.push_back(0);
+            sumY.push_back(0);
+        }
+        int id = blobOf[root];
+        Blob& b = blobs[id];
+        const Run& r = runs[i];
+        int len = r.end - r.start;
+        if (r.start < b.minX) b.minX = r.start;
+        if (r.end-1 > b.maxX) b.maxX = r.end-1;
+        if (r.row < b.minY) b.minY = r.row;
+        if (r.row > b.maxY) b.maxY = r.row;
+        b.area += len;
+        sumX[id] += len*(r.start + r.end - 1)/2.0;
+        sumY[id] += (double)len*r.row;
+    }
+    int kept = 0;
+    for (int i = 0; i < (int)blobs.size(); i++) {
+        Blob b = blobs[i];
+        if (b.area < minArea) continue;
+        b.centroidX = sumX[i]/b.area;
+        b.centroidY = sumY[i]/b.area;
+        b.extent = (double)b.area/((b.maxX-b.minX+1)*(b.maxY-b.minY+1));
+        blobs[kept++] = b;
+    }
+    blobs.resize(kept);
+}
+
+#endif
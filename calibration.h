@@ -0,0 +1,192 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Pixel-to-servo calibration. Sweeping the servos around a pose and watching where the
+// sun lands gives samples of how far a servo move shifts the sun in the image. A
+// quadratic fit of those, turned around, says which servo move brings a sun seen at some
+// pixel offset straight to the middle of the frame. The fit is stored as a lookup table
+// on disk so the tracker can slew onto the sun in one move instead of creeping up on it.
+
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <cstdio>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#ifndef CAMERA_WIDTH
+#define CAMERA_WIDTH 320 //Control Resolution from Camera
+#define CAMERA_HEIGHT 240 //Control Resolution from Camera
+#endif
+
+class Calibration {
+public:
+    static const int cellSize = 16; // pixels between table entries
+    static const int cols = CAMERA_WIDTH/cellSize + 1; // covers offsets -width/2 .. width/2
+    static const int rows = CAMERA_HEIGHT/cellSize + 1;
+    bool loaded = false;
+
+    // moving the servos by (dAzm, dElv) steps shifted the sun by (pixelDx, pixelDy)
+    void AddSample(double pixelDx, double pixelDy, double dAzm, double dElv) {
+        Sample s = {-pixelDx, -pixelDy, dAzm, dElv};
+        samples.push_back(s);
+    }
+
+    // fits the table to the samples, false if there aren't enough to fit
+    bool Fit();
+    bool Save(const char* fn) const;
+    bool Load(const char* fn);
+
+    // servo steps that bring a sun seen (ex, ey) pixels from the middle to the middle
+    void Lookup(double ex, double ey, double& dAzm, double& dElv) const;
+
+private:
+    struct Sample {
+        double ex, ey; // sun offset that the servo move below cancels
+        double dAzm, dElv;
+    };
+    std::vector<Sample> samples;
+    float azmTable[rows][cols];
+    float elvTable[rows][cols];
+
+    static void Terms(double ex, double ey, double t[6]) {
+        t[0] = 1;
+        t[1] = ex;
+        t[2] = ey;
+        t[3] = ex*ex;
+        t[4] = ex*ey;
+        t[5] = ey*ey;
+    }
+    static bool Solve(double a[6][6], double b[6], double x[6]);
+};
+
+// Gaussian elimination with partial pivoting, false if the samples don't pin the fit down
+inline bool Calibration::Solve(double a[6][6], double b[6], double x[6]) {
+    for (int c = 0; c < 6; c++) {
+        int pivot = c;
+        for (int r = c+1; r < 6; r++) {
+            if (fabs(a[r][c]) > fabs(a[pivot][c])) pivot = r;
+        }
+        if (fabs(a[pivot][c]) < 1e-9) return false;
+        for (int k = 0; k < 6; k++) std::swap(a[c][k], a[pivot][k]);
+        std::swap(b[c], b[pivot]);
+        for (int r = c+1; r < 6; r++) {
+            double f = a[r][c]/a[c][c];
+            for (int k = c; k < 6; k++) a[r][k] -= f*a[c][k];
+            b[r] -= f*b[c];
+        }
+    }
+    for (int r = 5; r >= 0; r--) {
+        double sum = b[r];
+        for (int k = r+1; k < 6; k++) sum -= a[r][k]*x[k];
+        x[r] = sum/a[r][r];
+    }
+    return true;
+}
+
+// least squares quadratic in (ex, ey) for each servo, sampled onto the table
+inline bool Calibration::Fit() {
+    if (samples.size() < 6) return false;
+    // offsets are scaled to about +-1 so the normal equations stay well conditioned
+    const double scale = CAMERA_WIDTH/2.0;
+    double coef[2][6];
+    for (int out = 0; out < 2; out++) {
+        double ata[6][6] = {{0}};
+        double atb[6] = {0};
+        for (const Sample& s : samples) {
+            double t[6];
+            Terms(s.ex/scale, s.ey/scale, t);
+            double y = out == 0 ? s.dAzm : s.dElv;
+            for (int i = 0; i < 6; i++) {
+                for (int j = 0; j < 6; j++) ata[i][j] += t[i]*t[j];
+                atb[i] += t[i]*y;
+            }
+        }
+        if (!Solve(ata, atb, coef[out])) return false;
+    }
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            double t[6];
+            Terms((c*cellSize - CAMERA_WIDTH/2)/scale, (r*cellSize - CAMERA_HEIGHT/2)/scale, t);
+            double azm = 0;
+            double elv = 0;
+            for (int i = 0; i < 6; i++) {
+                azm += coef[0][i]*t[i];
+                elv += coef[1][i]*t[i];
+            }
+            azmTable[r][c] = azm;
+            elvTable[r][c] = elv;
+        }
+    }
+    loaded = true;
+    return true;
+}
+
+inline bool Calibration::Save(const char* fn) const {
+    FILE* fp = fopen(fn, "w");
+    if (!fp) {
+        printf("Unable to open the file\n");
+        return false;
+    }
+    fprintf(fp, "# DreamTrack calibration: servo steps (azimuth elevation) to centre a sun\n");
+    fprintf(fp, "# seen at each pixel offset, rows of y, columns of x, every cellSize pixels\n");
+    fprintf(fp, "%d %d %d\n", cellSize, cols, rows);
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) fprintf(fp, "%.3f %.3f ", azmTable[r][c], elvTable[r][c]);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+    return true;
+}
+
+inline bool Calibration::Load(const char* fn) {
+    loaded = false;
+    FILE* fp = fopen(fn, "r");
+    if (!fp) return false;
+    // skip comments
+    int ch = getc(fp);
+    while (ch == '#') {
+        do {
+            ch = getc(fp);
+        } while (ch != '\n' && ch != EOF);
+        ch = getc(fp);
+    }
+    ungetc(ch, fp);
+    int size, c0, r0;
+    if (fscanf(fp, "%d%d%d", &size, &c0, &r0) != 3 || size != cellSize || c0 != cols || r0 != rows) {
+        printf("Calibration file '%s' doesn't match this camera, recalibrate\n", fn);
+        fclose(fp);
+        return false;
+    }
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            if (fscanf(fp, "%f%f", &azmTable[r][c], &elvTable[r][c]) != 2) {
+                printf("Calibration file '%s' is cut short\n", fn);
+                fclose(fp);
+                return false;
+            }
+        }
+    }
+    fclose(fp);
+    loaded = true;
+    return true;
+}
+
+// bilinear between the four table entries around the offset
+inline void Calibration::Lookup(double ex, double ey, double& dAzm, double& dElv) const {
+    double fx = (ex + CAMERA_WIDTH/2)/cellSize;
+    double fy = (ey + CAMERA_HEIGHT/2)/cellSize;
+    if (fx < 0) fx = 0;
+    if (fy < 0) fy = 0;
+    if (fx > cols-1) fx = cols-1;
+    if (fy > rows-1) fy = rows-1;
+    int c = (int)fx < cols-1 ? (int)fx : cols-2;
+    int r = (int)fy < rows-1 ? (int)fy : rows-2;
+    double u = fx - c;
+    double v = fy - r;
+    dAzm = (1-v)*((1-u)*azmTable[r][c] + u*azmTable[r][c+1]) + v*((1-u)*azmTable[r+1][c] + u*azmTable[r+1][c+1]);
+    dElv = (1-v)*((1-u)*elvTable[r][c] + u*elvTable[r][c+1]) + v*((1-u)*elvTable[r+1][c] + u*elvTable[r+1][c+1]);
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*Makes the colour table (colourTable.h) that
+ * tells the detector which pixels are the
+ * target, for the tracker to load. From a rule:
+ *   ratio 0.4          green under 0.4 of red, the sun's
+ *   hue 100 140 0.4 60 hues from 100 to 140 degrees, at least
+ *                      0.4 saturated and 60 bright
+ * or from example frames, labelled as for the tuner
+ * (tuner.cpp): pixels well inside the labelled sun
+ * are the target, those well outside it and in
+ * frames labelled none are not.
+ *   labels labels.txt
+ * Compile: g++ -O2 -o colourMaker colourMaker.cpp
+ * Run: ./colourMaker colours.txt ratio|hue|labels ... */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "colourTable.h"
+#include "ppm.h"
+
+double insideRadius = 0.8; // of the labelled radius, pixels nearer the centre are the target
+double outsideRadius = 1.2; // pixels further out are not; the edge in between is left out
+
+ColourTable colours;
+
+// 1 inside the sun, 0 outside it, -1 on its edge where it could be either
+int Side(const LabelledFrame& frame, int x, int y) {
+    if (!frame.sun) return 0;
+    double dx = x - frame.x;
+    double dy = y - frame.y;
+    double d2 = dx*dx + dy*dy;
+    double inside = insideRadius*frame.radius;
+    double outside = outsideRadius*frame.radius;
+    if (d2 <= inside*inside) return 1;
+    if (d2 >= outside*outside) return 0;
+    return -1;
+}
+
+// how much of the labelled suns and of the rest the table calls the target
+void Check(const std::vector<LabelledFrame>& frames) {
+    long in = 0, inHits = 0, out = 0, outHits = 0;
+    for (const LabelledFrame& frame : frames) {
+        for (int y = 0; y < frame.height; y++) {
+            for (int x = 0; x < frame.width; x++) {
+                int side = Side(frame, x, y);
+                if (side < 0) continue;
+                const unsigned char* p = &frame.pixels[(y*frame.width + x)*3];
+                bool hit = colours.IsTarget(p[0], p[1], p[2]);
+                if (side) {
+                    in++;
+                    inHits += hit;
+                } else {
+                    out++;
+                    outHits += hit;
+                }
+            }
+        }
+    }
+    printf("Target: %.1f%% of the pixels inside the suns, %.2f%% of those outside\n",
+           in ? 100.0*inHits/in : 0.0, out ? 100.0*outHits/out : 0.0);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        printf("Usage: %s colours.txt ratio maxGreenOverRed\n", argv[0]);
+        printf("       %s colours.txt hue from to minSaturation minValue\n", argv[0]);
+        printf("       %s colours.txt labels labels.txt\n", argv[0]);
+        return 1;
+    }
+    const char* rule = argv[2];
+    std::vector<LabelledFrame> frames;
+    if (strcmp(rule, "ratio") == 0) {
+        colours.Ratio(atof(argv[3]));
+    } else if (strcmp(rule, "hue") == 0 && argc >= 7) {
+        colours.Hue(atof(argv[3]), atof(argv[4]), atof(argv[5]), atoi(argv[6]));
+    } else if (strcmp(rule, "labels") == 0) {
+        if (!ReadLabels(argv[3], frames)) return 1;
+        if (frames.empty()) {
+            printf("No frames to learn from\n");
+            return 1;
+        }
+        for (const LabelledFrame& frame : frames) {
+            for (int y = 0; y < frame.height; y++) {
+                for (int x = 0; x < frame.width; x++) {
+                    int side = Side(frame, x, y);
+                    const unsigned char* p = &frame.pixels[(y*frame.width + x)*3];
+                    if (side >= 0) colours.AddExample(p[0], p[1], p[2], side == 1);
+                }
+            }
+        }
+        colours.FitExamples(); // colours no example has keep the sun's rule
+    } else {
+        printf("Unknown rule '%s', or too few values for it\n", rule);
+        return 1;
+    }
+    int cells = 0;
+    for (int r = 0; r < 256; r += 1 << ColourTable::cellBits) {
+        for (int g = 0; g < 256; g += 1 << ColourTable::cellBits) {
+            for (int b = 0; b < 256; b += 1 << ColourTable::cellBits) cells += colours.IsTarget(r, g, b);
+        }
+    }
+    printf("%d of %d cells are the target\n", cells, ColourTable::cells*ColourTable::cells*ColourTable::cells);
+    if (!frames.empty()) Check(frames);
+    if (!colours.Save(argv[1])) return 1;
+    printf("Saved colour table to %s\n", argv[1]);
+    return 0;
+}
@@ -0,0 +1,169 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Which colours are the target (sunDetector.h's red mask), as a 32x32x32 table over RGB,
+// each cell covering 8 levels of each channel. A pixel is classified by one lookup,
+// however complicated the rule the table was made from, so the tracker can follow other
+// markers, or see through a filter, without touching the detector. colourMaker.cpp makes
+// tables from a rule or from example frames, and the tracker loads them at startup. Until
+// one is made or loaded, the sun's own rule (green under 0.4 of red) is used as it is: 8
+// levels to a cell blur its edge, which moved the sun's centre by up to 3 pixels on our
+// test frames.
+
+#ifndef COLOUR_TABLE_H
+#define COLOUR_TABLE_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+class ColourTable {
+public:
+    static const int cellBits = 3; // low bits of each channel a cell ignores
+    static const int cells = 256 >> cellBits; // along each channel
+
+    bool active = false; // a table has been made or loaded
+
+    bool IsTarget(int red, int grn, int blu) const {
+        if (!active) return 5*grn < 2*red; // grn/red < 0.4, without the division
+        return (table[red >> cellBits][grn >> cellBits] >> (blu >> cellBits)) & 1;
+    }
+
+    // every cell takes the rule's verdict on the colour in its middle
+    template <typename Rule> void Fill(Rule rule);
+    // strongly red: green under maxGreenOverRed of red, as the sun has always been
+    void Ratio(double maxGreenOverRed);
+    // a hue range in degrees (from 340 to 20 wraps through red), with at least minSaturation
+    // (0-1) and minValue (0-255), for markers of other colours
+    void Hue(double from, double to, double minSaturation, int minValue);
+
+    // examples: cells that any example falls in go the way most of theirs do, the rest
+    // keep what they were, or the sun's rule
+    void AddExample(int red, int grn, int blu, bool target);
+    void FitExamples();
+
+    bool Save(const char* fn) const;
+    bool Load(const char* fn);
+
+private:
+    uint32_t table[cells][cells] = {}; // red cell, green cell: a bit per blue cell
+    std::vector<int> targets; // examples per cell, only while fitting
+    std::vector<int> others;
+
+    static int Cell(int red, int grn, int blu) {
+        return ((red >> cellBits)*cells + (grn >> cellBits))*cells + (blu >> cellBits);
+    }
+};
+
+template <typename Rule> inline void ColourTable::Fill(Rule rule) {
+    int middle = 1 << (cellBits-1);
+    for (int r = 0; r < cells; r++) {
+        for (int g = 0; g < cells; g++) {
+            uint32_t bits = 0;
+            for (int b = 0; b < cells; b++) {
+                if (rule((r << cellBits) + middle, (g << cellBits) + middle, (b << cellBits) + middle)) bits |= 1u << b;
+            }
+            table[r][g] = bits;
+        }
+    }
+    active = true;
+}
+
+inline void ColourTable::Ratio(double maxGreenOverRed) {
+    Fill([maxGreenOverRed](int red, int grn, int /*blu*/) {
+        return (float)grn/(float)red < maxGreenOverRed;
+    });
+}
+
+inline void ColourTable::Hue(double from, double to, double minSaturation, int minValue) {
+    Fill([from, to, minSaturation, minValue](int red, int grn, int blu) {
+        int hi = red > grn ? (red > blu ? red : blu) : (grn > blu ? grn : blu);
+        int lo = red < grn ? (red < blu ? red : blu) : (grn < blu ? grn : blu);
+        if (hi < minValue || hi == 0 || hi == lo || (double)(hi - lo)/hi < minSaturation) return false;
+        double hue;
+        if (hi == red) hue = 60.0*(grn - blu)/(hi - lo);
+        else if (hi == grn) hue = 120 + 60.0*(blu - red)/(hi - lo);
+        else hue = 240 + 60.0*(red - grn)/(hi - lo);
+        if (hue < 0) hue += 360;
+        return from <= to ? hue >= from && hue <= to : hue >= from || hue <= to;
+    });
+}
+
+inline void ColourTable::AddExample(int red, int grn, int blu, bool target) {
+    if (targets.empty()) {
+        targets.assign(cells*cells*cells, 0);
+        others.assign(cells*cells*cells, 0);
+    }
+    (target ? targets : others)[Cell(red, grn, blu)]++;
+}
+
+inline void ColourTable::FitExamples() {
+    if (!active) Ratio(0.4);
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i] == others[i]) continue; // no examples, or no telling
+        int r = i/(cells*cells);
+        int g = i/cells % cells;
+        int b = i % cells;
+        if (targets[i] > others[i]) table[r][g] |= 1u << b;
+        else table[r][g] &= ~(1u << b);
+    }
+    targets.clear();
+    others.clear();
+}
+
+inline bool ColourTable::Save(const char* fn) const {
+    if (!active) {
+        printf("No colour table to save, make one first\n");
+        return false;
+    }
+    FILE* fp = fopen(fn, "w");
+    if (!fp) {
+        printf("Unable to open the file\n");
+        return false;
+    }
+    fprintf(fp, "# DreamTrack colour table: a line per red cell, a word per green cell,\n");
+    fprintf(fp, "# a bit per blue cell, set where the colour is the target\n");
+    fprintf(fp, "%d\n", cells);
+    for (int r = 0; r < cells; r++) {
+        for (int g = 0; g < cells; g++) fprintf(fp, "%08x ", (unsigned)table[r][g]);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+    return true;
+}
+
+// the table is left as it was unless the whole file reads
+inline bool ColourTable::Load(const char* fn) {
+    FILE* fp = fopen(fn, "r");
+    if (!fp) return false;
+    // skip comments
+    int ch = getc(fp);
+    while (ch == '#') {
+        do {
+            ch = getc(fp);
+        } while (ch != '\n' && ch != EOF);
+        ch = getc(fp);
+    }
+    ungetc(ch, fp);
+    int size;
+    bool ok = fscanf(fp, "%d", &size) == 1 && size == cells;
+    uint32_t read[cells][cells];
+    for (int r = 0; ok && r < cells; r++) {
+        for (int g = 0; ok && g < cells; g++) {
+            unsigned bits;
+            ok = fscanf(fp, "%x", &bits) == 1;
+            read[r][g] = bits;
+        }
+    }
+    fclose(fp);
+    if (!ok) {
+        printf("Colour table '%s' is not a %dx%dx%d table\n", fn, cells, cells, cells);
+        return false;
+    }
+    memcpy(table, read, sizeof(table));
+    active = true;
+    return true;
+}
+
+#endif
@@ -0,0 +1,45 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Where the real sun is in the sky, from the clock and where the rig stands, with no
+// network or tables. The low precision solar position formulas are good to about a
+// hundredth of a degree, far finer than one servo step.
+
+#ifndef EPHEMERIS_H
+#define EPHEMERIS_H
+
+#include <cmath>
+#include <ctime>
+
+class Ephemeris {
+public:
+    double latitude = -41.29; // degrees, north positive
+    double longitude = 174.78; // degrees, east positive
+
+    // compass bearing (north 0, east 90) and elevation above the horizon, in degrees, at time t
+    void SunPosition(time_t t, double& azimuth, double& elevation) const;
+};
+
+inline void Ephemeris::SunPosition(time_t t, double& azimuth, double& elevation) const {
+    const double rad = M_PI/180.0;
+    double d = t/86400.0 - 10957.5; // days since noon on 1 January 2000, UTC
+
+    // where the sun is along the ecliptic
+    double anomaly = fmod(357.529 + 0.98560028*d, 360.0)*rad;
+    double meanLong = 280.459 + 0.98564736*d;
+    double eclLong = (meanLong + 1.915*sin(anomaly) + 0.020*sin(2*anomaly))*rad;
+    double tilt = (23.439 - 0.00000036*d)*rad;
+
+    // to right ascension and declination, then to the local sky
+    double ra = atan2(cos(tilt)*sin(eclLong), cos(eclLong));
+    double dec = asin(sin(tilt)*sin(eclLong));
+    double siderealDeg = fmod(280.46061837 + 360.98564736629*d, 360.0);
+    double hourAngle = (siderealDeg + longitude)*rad - ra;
+    double lat = latitude*rad;
+
+    elevation = asin(sin(lat)*sin(dec) + cos(lat)*cos(dec)*cos(hourAngle))/rad;
+    azimuth = atan2(-sin(hourAngle)*cos(dec), sin(dec)*cos(lat) - cos(dec)*sin(lat)*cos(hourAngle))/rad;
+    if (azimuth < 0) azimuth += 360.0;
+}
+
+#endif
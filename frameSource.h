@@ -0,0 +1,330 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Where frames come from: the E101 camera, PPM files, or a replay of a recorded session,
+// all as packed RGB frames like sunDetector.h reads. FramePipeline captures from a source
+// on its own thread into a few buffers of its own and hands them to the tracker by
+// pointer, so the next frame is being captured while this one is detected. Sources fill a
+// frame from the top down and say how many rows are in as they go, so the tracker can
+// start detecting a frame before the last of it has arrived (see NextStreaming()).
+
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "E101.h"
+#include "overlay.h"
+#include "ppm.h"
+#include "stats.h"
+
+#ifndef CAMERA_WIDTH
+#define CAMERA_WIDTH 320 //Control Resolution from Camera
+#define CAMERA_HEIGHT 240 //Control Resolution from Camera
+#endif
+
+// How many rows of a frame are in. The capture sets it a band of rows at a time, and the
+// tracker sleeps in Wait() until there are more, rather than spinning on the count.
+class RowCount {
+public:
+    void Reset() {
+        std::lock_guard<std::mutex> lock(m);
+        rows = 0;
+        ended = false;
+    }
+    void Set(int n) {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            rows = n;
+        }
+        cv.notify_all();
+    }
+    // no more rows are coming
+    void End() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            ended = true;
+        }
+        cv.notify_all();
+    }
+    // blocks until more than have rows are in and returns how many, or -1 once it's ended
+    int Wait(int have) {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [this, have] { return rows > have || ended; });
+        return rows > have ? rows : -1;
+    }
+
+private:
+    std::mutex m;
+    std::condition_variable cv;
+    int rows = 0;
+    bool ended = false;
+};
+
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+    // fills frame from the top down, storing how many rows are in to rows (if given) as
+    // they arrive; false once there are no more frames
+    virtual bool Capture(unsigned char* frame, RowCount* rows = nullptr) = 0;
+
+protected:
+    static void RowsIn(RowCount* rows, int n) {
+        if (rows) rows->Set(n);
+    }
+};
+
+class CameraSource : public FrameSource {
+public:
+    Overlay* overlay = nullptr; // shows the camera's buffer on the screen once it's copied out
+    int bandRows = 16; // rows copied out between each wake of the tracker
+
+    // take_picture() gets the whole frame at once, the rows come in as they're copied out
+    bool Capture(unsigned char* frame, RowCount* rows) override {
+        std::unique_lock<std::mutex> screen;
+        if (overlay) screen = std::unique_lock<std::mutex>(overlay->Screen()); // not while it's on the screen
+        {
+            TIME_STAGE(STAGE_CAPTURE);
+            take_picture();
+        }
+        {
+            TIME_STAGE(STAGE_COPY);
+            for (int row = 0; row<CAMERA_HEIGHT; row++) {
+                for (int col = 0; col<CAMERA_WIDTH; col++) {
+                    for (int color = 0; color<3; color++) {
+                        frame[CAMERA_WIDTH*row*3 + col*3 + color] = get_pixel(row, col, color);
+                    }
+                }
+                if ((row+1) % bandRows == 0 || row+1 == CAMERA_HEIGHT) RowsIn(rows, row+1);
+            }
+        }
+        if (overlay) {
+            screen.unlock();
+            overlay->CameraFrame();
+        }
+        return true;
+    }
+};
+
+// Binary PPMs of CAMERA_WIDTH x CAMERA_HEIGHT, one after another. A file may hold several
+// frames back to back, which is how sessions are recorded (see RecordFrame()), so replaying
+// a session is just reading it; loop starts over from the first file at the end.
+class PpmSource : public FrameSource {
+public:
+    int bandRows = 16; // rows read at a time
+
+    PpmSource(const std::vector<std::string>& files, bool loop) : files(files), loop(loop) {}
+    ~PpmSource() { if (fp) fclose(fp); }
+
+    bool Capture(unsigned char* frame, RowCount* rows) override {
+        for (int tries = 0; tries <= (int)files.size(); tries++) {
+            if (fp && ReadFrame(frame, rows)) return true;
+            if (fp) fclose(fp);
+            fp = nullptr;
+            if (next == files.size()) {
+                if (!loop) return false;
+                next = 0;
+            }
+            const char* fn = files[next++].c_str();
+            fp = fopen(fn, "rb");
+            if (!fp) printf("Unable to open file '%s'\n", fn);
+        }
+        return false;
+    }
+
+private:
+    std::vector<std::string> files;
+    bool loop;
+    size_t next = 0;
+    FILE* fp = nullptr;
+
+    bool ReadFrame(unsigned char* frame, RowCount* rows) {
+        int width, height;
+        if (!ReadPpmHeader(fp, width, height)) return false;
+        if (width != CAMERA_WIDTH || height != CAMERA_HEIGHT) {
+            printf("Frame is %dx%d, not %dx%d\n", width, height, CAMERA_WIDTH, CAMERA_HEIGHT);
+            return false;
+        }
+        int rowSize = CAMERA_WIDTH*3;
+        for (int row = 0; row < CAMERA_HEIGHT; row += bandRows) {
+            int n = CAMERA_HEIGHT-row < bandRows ? CAMERA_HEIGHT-row : bandRows;
+            if ((int)fread(frame + row*rowSize, rowSize, n, fp) != n) return false;
+            RowsIn(rows, row+n);
+        }
+        return true;
+    }
+};
+
+// appends a frame to a session file that PpmSource can replay
+inline void RecordFrame(FILE* fp, const unsigned char* frame) {
+    fprintf(fp, "P6\n%d %d 255\n", CAMERA_WIDTH, CAMERA_HEIGHT);
+    fwrite(frame, 1, CAMERA_WIDTH*CAMERA_HEIGHT*3, fp);
+}
+
+class FramePipeline {
+public:
+    // keepLatest drops frames the tracker didn't get to in time, which a live camera
+    // wants; a replay keeps every frame so runs repeat exactly
+    FramePipeline(FrameSource* source, int numBuffers, bool keepLatest)
+        : source(source), keepLatest(keepLatest), buffers(numBuffers < 2 ? 2 : numBuffers),
+          started(buffers.size()), rows(new RowCount[buffers.size()]) {
+        for (size_t i = 0; i < buffers.size(); i++) {
+            buffers[i].assign(CAMERA_WIDTH*CAMERA_HEIGHT*3, 0); // allocated and faulted in now
+            spare.push_back(i);
+        }
+    }
+
+    void Start() {
+        running = true;
+        worker = std::thread(&FramePipeline::Run, this);
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            running = false;
+        }
+        cv.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+
+    ~FramePipeline() { Stop(); }
+
+    pthread_t NativeHandle() { return worker.native_handle(); }
+
+    // The next frame whose capture began after the given time (any, by default). It stays
+    // the tracker's until the next call. nullptr once the source has run out.
+    const unsigned char* Next(std::chrono::steady_clock::time_point after = std::chrono::steady_clock::time_point());
+
+    // Like Next(), but may hand over the frame still being captured, the newest there is
+    // for a live camera, so it can be worked on as its rows come in. WaitRows() then blocks
+    // until more than have rows of it are in and returns how many, or -1 if the source
+    // ran out partway.
+    const unsigned char* NextStreaming(std::chrono::steady_clock::time_point after = std::chrono::steady_clock::time_point());
+    int WaitRows(int have);
+
+private:
+    FrameSource* source;
+    bool keepLatest;
+    std::vector<std::vector<unsigned char> > buffers;
+    std::vector<std::chrono::steady_clock::time_point> started; // when each buffer's capture began
+    std::unique_ptr<RowCount[]> rows; // rows of each buffer captured so far
+    std::deque<int> ready; // captured, oldest first
+    std::vector<int> spare;
+    int held = -1; // the buffer the tracker has
+    int filling = -1; // the buffer being captured into
+    bool taken = false; // and the tracker has it already
+    std::atomic<bool> ended{false};
+    bool running = false;
+    std::mutex m;
+    std::condition_variable cv;
+    std::thread worker;
+
+    void Release();
+    void Run();
+};
+
+// gives back the tracker's buffer, once it's not being captured into
+inline void FramePipeline::Release() {
+    if (held >= 0 && !(taken && held == filling)) spare.push_back(held);
+    held = -1;
+    cv.notify_all();
+}
+
+inline const unsigned char* FramePipeline::Next(std::chrono::steady_clock::time_point after) {
+    std::unique_lock<std::mutex> lock(m);
+    Release();
+    while (true) {
+        // frames from before the servos moved, or older than the newest if only that's wanted
+        while (!ready.empty() && (started[ready.front()] < after || (keepLatest && ready.size() > 1))) {
+            spare.push_back(ready.front());
+            ready.pop_front();
+            cv.notify_all();
+        }
+        if (!ready.empty()) break;
+        if (ended) return nullptr;
+        cv.wait(lock);
+    }
+    held = ready.front();
+    ready.pop_front();
+    return buffers[held].data();
+}
+
+inline const unsigned char* FramePipeline::NextStreaming(std::chrono::steady_clock::time_point after) {
+    std::unique_lock<std::mutex> lock(m);
+    Release();
+    while (true) {
+        // a replay takes every frame in order; a live camera the one coming in if it's fresh
+        bool fresh = filling >= 0 && started[filling] >= after;
+        while (!ready.empty() && (started[ready.front()] < after || (keepLatest && (ready.size() > 1 || fresh)))) {
+            spare.push_back(ready.front());
+            ready.pop_front();
+            cv.notify_all();
+        }
+        if (!ready.empty()) {
+            held = ready.front();
+            ready.pop_front();
+            break;
+        }
+        if (fresh) {
+            held = filling;
+            taken = true;
+            break;
+        }
+        if (ended) return nullptr;
+        cv.wait(lock);
+    }
+    return buffers[held].data();
+}
+
+// only the buffer being captured is ever short of rows, and its capture wakes us
+inline int FramePipeline::WaitRows(int have) {
+    return rows[held].Wait(have);
+}
+
+inline void FramePipeline::Run() {
+    std::unique_lock<std::mutex> lock(m);
+    while (running) {
+        if (spare.empty() && keepLatest && !ready.empty()) { // reuse the stalest
+            spare.push_back(ready.front());
+            ready.pop_front();
+        }
+        if (spare.empty()) {
+            cv.wait(lock);
+            continue;
+        }
+        int b = spare.back();
+        spare.pop_back();
+        started[b] = std::chrono::steady_clock::now();
+        rows[b].Reset();
+        filling = b;
+        cv.notify_all();
+        lock.unlock();
+        bool ok = source->Capture(buffers[b].data(), &rows[b]);
+        lock.lock();
+        filling = -1;
+        if (ok) rows[b].Set(CAMERA_HEIGHT);
+        bool wasTaken = taken;
+        taken = false;
+        if (!ok) {
+            ended = true;
+            rows[b].End();
+            if (held != b) spare.push_back(b);
+            cv.notify_all();
+            return;
+        }
+        if (!wasTaken) ready.push_back(b);
+        else if (held != b) spare.push_back(b); // the tracker took it as it came in, and is done
+        cv.notify_all();
+    }
+}
+
+#endif
@@ -0,0 +1,98 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Latency histogram in the style of HdrHistogram: exact below 16 microseconds, then 8
+// buckets per power of two, so every value is kept to within 12.5% from microseconds up
+// to over an hour in a fixed 2 KB, and recording is a couple of instructions.
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+class LatencyHistogram {
+public:
+    static const int numBuckets = 240;
+
+    LatencyHistogram() { Clear(); }
+
+    void Clear() {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        sum = 0;
+        max = 0;
+    }
+
+    void Record(uint32_t us) {
+        counts[Bucket(us)]++;
+        total++;
+        sum += us;
+        if (us > max) max = us;
+    }
+
+    // adds another histogram's counts into this one
+    void Add(const LatencyHistogram& h) {
+        for (int i = 0; i < numBuckets; i++) counts[i] += h.counts[i];
+        total += h.total;
+        sum += h.sum;
+        if (h.max > max) max = h.max;
+    }
+
+    long Count() const { return total; }
+    uint32_t Max() const { return max; }
+    double Mean() const { return total ? (double)sum/total : 0; }
+
+    // smallest value that p percent of the samples are at or under, to the bucket
+    uint32_t Percentile(double p) const;
+
+    // count, mean, percentiles and max on one line
+    void PrintLine(const char* name) const;
+    // that, then one line per bucket that has anything in it
+    void Print(const char* name) const;
+
+private:
+    long counts[numBuckets];
+    long total;
+    uint64_t sum;
+    uint32_t max;
+
+    static int Bucket(uint32_t v) {
+        if (v < 16) return v;
+        int shift = 28 - __builtin_clz(v); // leaves v >> shift in 8..15
+        return shift*8 + (v >> shift);
+    }
+    // smallest value that lands in bucket i
+    static uint32_t Low(int i) {
+        if (i < 16) return i;
+        return (uint32_t)(i%8 + 8) << (i/8 - 1);
+    }
+    static uint32_t High(int i) { return i+1 < numBuckets ? Low(i+1) - 1 : UINT32_MAX; }
+};
+
+inline uint32_t LatencyHistogram::Percentile(double p) const {
+    long want = (long)(total*p/100.0 + 0.5);
+    if (want < 1) want = 1;
+    long seen = 0;
+    for (int i = 0; i < numBuckets; i++) {
+        seen += counts[i];
+        if (seen >= want) return High(i) < max ? High(i) : max;
+    }
+    return max;
+}
+
+inline void LatencyHistogram::PrintLine(const char* name) const {
+    printf("%s (us): n=%ld mean=%.0f p50=%u p90=%u p99=%u p99.9=%u max=%u\n", name, total, Mean(),
+           Percentile(50), Percentile(90), Percentile(99), Percentile(99.9), max);
+}
+
+inline void LatencyHistogram::Print(const char* name) const {
+    PrintLine(name);
+    for (int i = 0; i < numBuckets; i++) {
+        if (counts[i] == 0) continue;
+        printf("  %10u - %10u: %ld\n", Low(i), High(i), counts[i]);
+    }
+}
+
+#endif
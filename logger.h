@@ -0,0 +1,236 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Asynchronous logger for the tracking loop. A log call only copies the format string's
+// address and its arguments into the thread's ring (ring.h); a background thread does the
+// printf formatting and the slow terminal or file writes. When the ring is full the
+// message is dropped rather than the loop held up. Until Start() is called (testImage
+// never does) messages are formatted and printed straight away, exactly like printf.
+//
+// Format strings must be string literals, and %s arguments must outlive the message
+// (literals again), since only their addresses are kept.
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include "ring.h"
+
+enum LogLevel {
+    LEVEL_DEBUG, // per frame detail: radius, peaks, why a candidate failed
+    LEVEL_INFO,  // what the tracker is doing: losing and finding the sun, scanning
+    LEVEL_WARN
+};
+
+union LogArg {
+    long long i;
+    double d;
+    const char* s;
+};
+
+struct LogRecord {
+    const char* fmt;
+    int numArgs;
+    LogArg args[6];
+};
+
+// one per log statement, for rate limiting
+struct LogSite {
+    std::atomic<long> second{-1};
+    std::atomic<int> count{0};
+};
+
+class Logger {
+public:
+    static const int maxThreads = 64; // heads, pool workers, capture, servo and telemetry threads
+    static const int maxArgs = 6;
+    int level = LEVEL_DEBUG; // messages below this are skipped before anything is copied
+    int rateLimit = 0; // messages per second from any one log statement, 0 for no limit
+
+    static Logger& Global() {
+        static Logger logger;
+        return logger;
+    }
+
+    // from now on messages go through the background thread, to out
+    void Start(FILE* out);
+    // writes out whatever is still queued and stops the thread
+    void Stop();
+    ~Logger() { Stop(); }
+
+    template <typename... Args>
+    void Write(LogSite& site, int lvl, const char* fmt, Args... args) {
+        static_assert(sizeof...(Args) <= maxArgs, "too many log arguments");
+        if (lvl < level) return;
+        if (rateLimit > 0 && Limited(site)) return;
+        LogRecord r;
+        r.fmt = fmt;
+        r.numArgs = sizeof...(Args);
+        Pack(r.args, args...);
+        if (!running) {
+            Print(r, stdout);
+            return;
+        }
+        LogRing* ring = Ring();
+        if (ring) ring->Push(r);
+        else ringless.fetch_add(1, std::memory_order_relaxed); // a ring has only its own writer
+    }
+
+private:
+    typedef SpscRing<LogRecord, 1024> LogRing;
+    std::atomic<LogRing*> rings[maxThreads] = {};
+    std::atomic<int> numRings{0};
+    std::atomic<long> ringless{0}; // messages from threads past maxThreads, which have no ring
+    std::atomic<bool> running{false};
+    std::atomic<long> limited{0};
+    std::thread worker;
+    FILE* out = stdout;
+
+    static void Pack(LogArg*) {}
+    template <typename T, typename... Rest>
+    static void Pack(LogArg* a, T first, Rest... rest) {
+        Set(*a, first);
+        Pack(a + 1, rest...);
+    }
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type Set(LogArg& a, T v) {
+        a.i = (long long)v;
+    }
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type Set(LogArg& a, T v) { a.d = v; }
+    static void Set(LogArg& a, const char* v) { a.s = v; }
+
+    bool Limited(LogSite& site);
+    LogRing* Ring();
+    static void Print(const LogRecord& r, FILE* fp);
+    int DrainAll();
+    void Run();
+};
+
+// true if this statement has already said rateLimit things this second
+inline bool Logger::Limited(LogSite& site) {
+    long now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (site.second.exchange(now, std::memory_order_relaxed) != now) site.count = 0;
+    if (site.count.fetch_add(1, std::memory_order_relaxed) < rateLimit) return false;
+    limited.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// this thread's ring, made the first time it logs anything; nullptr past maxThreads
+inline Logger::LogRing* Logger::Ring() {
+    thread_local LogRing* ring = nullptr;
+    thread_local bool registered = false;
+    if (registered) return ring;
+    registered = true;
+    int i = numRings.fetch_add(1);
+    if (i >= maxThreads) return nullptr;
+    ring = new LogRing;
+    rings[i].store(ring, std::memory_order_release);
+    return ring;
+}
+
+// printf, one conversion at a time, taking each argument as the conversion expects
+inline void Logger::Print(const LogRecord& r, FILE* fp) {
+    char line[512];
+    int len = 0;
+    int arg = 0;
+    const char* p = r.fmt;
+    while (*p && len < (int)sizeof(line) - 1) {
+        if (*p != '%') {
+            line[len++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            line[len++] = '%';
+            p += 2;
+            continue;
+        }
+        // copy flags, width and precision, drop any length modifier
+        char spec[32];
+        int n = 0;
+        spec[n++] = *p++;
+        while (*p && strchr("-+ #0123456789.", *p) && n < 24) spec[n++] = *p++;
+        while (*p && strchr("hlLqjzt", *p)) p++;
+        char conv = *p ? *p++ : 'd';
+        int room = sizeof(line) - len;
+        int wrote = 0;
+        if (arg >= r.numArgs) {
+            wrote = snprintf(line + len, room, "?");
+        } else if (strchr("diouxXc", conv)) {
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conv == 'c' ? 'd' : conv;
+            spec[n] = 0;
+            if (conv == 'c') wrote = snprintf(line + len, room, "%c", (char)r.args[arg].i);
+            else wrote = snprintf(line + len, room, spec, r.args[arg].i);
+        } else if (strchr("fFeEgGaA", conv)) {
+            spec[n++] = conv;
+            spec[n] = 0;
+            wrote = snprintf(line + len, room, spec, r.args[arg].d);
+        } else if (conv == 's') {
+            spec[n++] = 's';
+            spec[n] = 0;
+            wrote = snprintf(line + len, room, spec, r.args[arg].s ? r.args[arg].s : "(null)");
+        }
+        arg++;
+        len += wrote < room ? wrote : room - 1;
+    }
+    line[len] = 0;
+    fputs(line, fp);
+}
+
+inline int Logger::DrainAll() {
+    int total = 0;
+    int n = numRings.load() < maxThreads ? numRings.load() : maxThreads;
+    for (int i = 0; i < n; i++) {
+        LogRing* ring = rings[i].load(std::memory_order_acquire);
+        if (!ring) continue; // still being registered
+        total += ring->Drain([this](const LogRecord& r) { Print(r, out); });
+    }
+    if (total) fflush(out);
+    return total;
+}
+
+inline void Logger::Run() {
+    while (running) {
+        if (DrainAll() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+inline void Logger::Start(FILE* fp) {
+    if (running) return;
+    out = fp;
+    running = true;
+    worker = std::thread(&Logger::Run, this);
+}
+
+inline void Logger::Stop() {
+    if (!running) return;
+    running = false;
+    if (worker.joinable()) worker.join();
+    DrainAll();
+    long dropped = ringless;
+    int n = numRings.load() < maxThreads ? numRings.load() : maxThreads;
+    for (int i = 0; i < n; i++) {
+        LogRing* ring = rings[i].load(std::memory_order_acquire);
+        if (ring) dropped += ring->dropped;
+    }
+    if (dropped || limited) fprintf(out, "Log: %ld messages dropped, %ld rate limited\n", dropped, (long)limited);
+    fflush(out);
+}
+
+#define LOG_AT(lvl, ...) do { \
+        static LogSite logSite; \
+        Logger::Global().Write(logSite, lvl, __VA_ARGS__); \
+    } while (0)
+#define LOG_DEBUG(...) LOG_AT(LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LEVEL_WARN, __VA_ARGS__)
+
+#endif
@@ -6,236 +6,765 @@
 #include <cstdlib>
 #include <cctype>
 #include <cmath>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <csignal>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <functional>
 #include "E101.h"
-#define CAMERA_WIDTH 320 //Control Resolution from Camera
-#define CAMERA_HEIGHT 240 //Control Resolution from Camera
-double DEG2RAD = M_PI/180.0;
+#include "sunDetector.h"
+#include "pid.h"
+#include "servoScheduler.h"
+#include "calibration.h"
+#include "ephemeris.h"
+#include "histogram.h"
+#include "realtime.h"
+#include "stats.h"
+#include "logger.h"
+#include "overlay.h"
+#include "frameSource.h"
+#include "telemetry.h"
+#include "workPool.h"
+// servo positions and errors are fixed-point with the same fraction bits as the sun's
+// refined centre, so moves smaller than one servo step add up instead of truncating to 0
+#define FIX_BITS SUBPIXEL_BITS
+#define FIX(v) ((v) << FIX_BITS)
+
+// what FollowSun() is doing about the sun
+enum TrackState {
+    TRACKING,     // in view, the PID follows it
+    LOCAL_SEARCH, // just lost, hold still and look again where it was
+    SCANNING      // spiral the servos out from where it was lost until it turns up
+};
 
 class Tracker {
 private:
-    int elevation = 57;
-    const int elv_servo = 5;
-    int azimuth = 53;
-    const int azm_servo = 3;
+    int elevation = FIX(57);
+    int elv_servo = 5; // motor ports, ./main servos <elv> <azm> for another head's
+    int azimuth = FIX(53);
+    int azm_servo = 3;
     int min_tilt = 32;
     int max_tilt = 65;
-    int xError, yError;
+    int xError, yError; // fixed-point pixels from the middle of the frame
     bool isSunUp;
+    Pid azmPid;
+    Pid elvPid;
+    ServoScheduler& servos; // moves the servos from its own thread, shared by every head
+    int head; // which tracker this is in the process, from 0
+    int elvChannel, azmChannel;
+    Calibration calibration; // pixel offset to servo move, from Calibrate()
+    std::chrono::steady_clock::time_point lastUpdate;
 
     // thresholds to play around with:
     double convThreshold = 65.0;
-    int radiusRange = 5;
+    int edgeThreshold = EDGE_FIXED; // or take it from each frame's gradients, see sunDetector.h
+    int radiusRange = 0; // ring spread either side of the radius, 0 sizes it from the radius
     int degStep = 10;
     int voteThr = 10;
-    double kp = 0.05;
+    bool searchRadius = false; // find the radius with a 3-D accumulator, see sunDetector.h
+    bool useBlobs = false; // vote only inside round red blobs, see sunDetector.h
+    int peakCandidates = 1; // circle centres to try before giving up on a frame
+    bool thinEdges = false; // one pixel wide red edges, see sunDetector.h
+    double voteBudgetMs = 0; // most time a frame may spend voting, 0 for no limit
+    int decayShift = 0; // carry votes over from frame to frame, see sunDetector.h; 0 doesn't
+    int anglePhases = 1; // frames the angles are spread over while carrying votes over
+    std::string settingsFile; // detector.txt, or detector<head>.txt: the tuner's (tuner.cpp), over the ones above
+    std::string coloursFile; // colours.txt, or colours<head>.txt: what's the target, from colourMaker.cpp
+    // PID gains: kp in steps per pixel, ki and kd per second so they hold at any frame rate (see pid.h)
+    double kp = 0.02;
+    double ki = 0.05;
+    double kd = 0.004;
+
+    // calibration: slew straight onto a sun further than jumpError pixels off centre
+    std::string calibrationFile; // calibration.txt, or calibration<head>.txt for the others
+    int jumpError = 20;
+    int jumpSettleMs = 200; // after a jump's servos arrive, before the next frame counts
+    int calSpan = 6; // servo steps swept either side of the starting pose
+    int calStep = 3;
+    int calSettleMs = 500; // after the servos arrive, for the camera to catch up
+
+    // acquisition: when the sun is lost, look near where it was for localFrames frames,
+    // then scan poses scanStep servo steps apart out to scanRings rings from the last pose
+    int localFrames = 3;
+    int roiMargin = 20; // pixels around the last sun that the local search looks in
+    int scanStep = 5; // less than a frame's worth of view, so neighbouring poses overlap
+    int scanRings = 3; // (2*scanRings+1)^2 poses at most before the scan starts over
+    int scanMinRed = 300; // sun coloured pixels a scan pose needs before the full detection runs
+    int scanSettleMs = 200;
+
+    int state = TRACKING;
+    int lostFrames = 0;
+    int lastX = 0, lastY = 0, lastRadius = 0; // where the sun was last seen, 0 radius if never
+    int scanAzm, scanElv; // pose the scan spirals out from
+    std::vector<std::pair<int, int> > scanPoses; // (azimuth, elevation) offsets, spiral order
+    int scanIndex = 0;
+
+    // ephemeris: where the real sun should be, from the clock and ephemeris.latitude/longitude.
+    // The servos follow its motion between detections and the searches start from it.
+    bool useEphemeris = false;
+    double mountHeading = 0.0; // compass bearing the camera faces at the starting pose
+    double mountAltitude = 30.0; // degrees above the horizon it faces at the starting pose
+    double pixelsPerStep = 30.0; // how far one servo step moves the sun in the image
+    Ephemeris ephemeris;
+    int homeAzm, homeElv; // the starting pose
+    time_t seenTime = 0; // when the sun was last seen, and the pose then
+    int seenAzm, seenElv;
+    double ffAzm, ffElv; // predicted pose the servos have been fed forward to
+
+    // real-time mode (sudo ./main realtime), see realtime.h
+    bool realTime = false;
+    int visionCpu = 2; // cores for the detection loop (pool workers from here on) and the servo thread
+    int servoCpu = 3;
+    int fifoPriority = 0; // 1..98 runs them SCHED_FIFO, the servo thread one higher; 0 doesn't
+
+    Overlay overlay; // debug drawing on the live screen, overlay.every frames
+    int overlayEvery = 5; // 0 draws only on SIGUSR2, which saves the most time
+
+    LatencyHistogram framePeriod; // microseconds between FollowSun() calls
+    std::chrono::steady_clock::time_point lastFrame;
+
+    // frames are captured on their own thread into frameBuffers buffers (frameSource.h),
+    // from the camera or replayed from PPM files (sudo ./main replay session.ppm ...)
+    int frameBuffers = 3;
+    int captureCpu = 1; // core for the capture thread in real-time mode, the next for head 1's and so on
+    std::vector<std::string> replayFiles;
+    const char* recordFile = nullptr; // every frame is appended here, for replaying later
+    FILE* record = nullptr;
+    CameraSource camera;
+    std::unique_ptr<FrameSource> files;
+    std::unique_ptr<FramePipeline> pipeline;
+    bool finished = false; // the replay has run out
+    bool jumped = false; // the last frame jumped, so the next one waits for the servos
+    bool streamRows = false; // detect each frame band by band as it comes in (./main stream)
+
+    // every frame's result is sent to a PC running telemetryServer (./main telemetry <address>)
+    Telemetry telemetry;
+    const char* telemetryAddress = nullptr;
+    int telemetryPort = 1024;
+
+    SunDetector sun;
+    const unsigned char* frame = nullptr; // the frame being worked on, owned by pipeline
+
+    static int Servo(int fixed) { return (fixed + (1 << (FIX_BITS-1))) >> FIX_BITS; }
+
+    bool GrabFrame(std::chrono::steady_clock::time_point after);
+    int DetectSun(bool rowsAdded = false);
+    int StreamSun(std::chrono::steady_clock::time_point after);
+    std::chrono::steady_clock::time_point WaitForServos(int settleMs);
+    void SeenSun();
+    void StartScan();
+    void NextScanPose();
+    void ScanStep();
+    void PredictPose(time_t t, double& azm, double& elv) const;
+    void PredictedShift(double& dAzm, double& dElv) const;
+    void FeedForward();
+    void GoRealTime();
 
 public:
+    // head numbers the trackers in one process, from 0
+    Tracker(ServoScheduler& servos, int head)
+        : servos(servos),
+          head(head),
+          settingsFile(head == 0 ? "detector.txt" : "detector" + std::to_string(head) + ".txt"),
+          coloursFile(head == 0 ? "colours.txt" : "colours" + std::to_string(head) + ".txt"),
+          calibrationFile(head == 0 ? "calibration.txt" : "calibration" + std::to_string(head) + ".txt") {}
     int InitHardware();
     void SetMotors();
-    int MeasureSun();
+    int MeasureSun(std::chrono::steady_clock::time_point after = std::chrono::steady_clock::time_point());
     void FollowSun();
+    int Calibrate();
+    void Shutdown();
+    void Report(const char* name);
+    void RealTimeThreads(WorkPool* pool);
+    void UseRealTime(bool on) { realTime = on; }
+    void Replay(const std::vector<std::string>& fns) { replayFiles = fns; }
+    void RecordTo(const char* fn) { recordFile = fn; }
+    void StreamRows(bool on) { streamRows = on; }
+    void SendTelemetry(const char* address) { telemetryAddress = address; }
+    void UseServos(int elv, int azm) {
+        elv_servo = elv;
+        azm_servo = azm;
+    }
+    bool UsesCamera() const { return replayFiles.empty(); }
+    bool Finished() const { return finished; }
 };
 
+// call init() before the first head's
 int Tracker::InitHardware() {
-    int err;
-    err = init(0);
-    open_screen_stream();
-    SetMotors();
-    take_picture();
-    update_screen();
+    sun.convThreshold = convThreshold;
+    sun.edgeThreshold = edgeThreshold;
+    sun.radiusRange = radiusRange;
+    sun.degStep = degStep;
+    sun.voteThr = voteThr;
+    sun.searchRadius = searchRadius;
+    sun.useBlobs = useBlobs;
+    sun.peakCandidates = peakCandidates;
+    sun.thinEdges = thinEdges;
+    sun.voteBudgetMs = voteBudgetMs;
+    sun.decayShift = decayShift;
+    sun.anglePhases = anglePhases;
+    if (sun.LoadSettings(settingsFile.c_str())) printf("Loaded detector settings from %s\n", settingsFile.c_str());
+    if (sun.colours.Load(coloursFile.c_str())) printf("Loaded colour table from %s\n", coloursFile.c_str());
+    Pid* pids[] = {&azmPid, &elvPid};
+    for (Pid* pid : pids) {
+        pid->kp = kp;
+        pid->ki = ki;
+        pid->kd = kd;
+        pid->minOut = min_tilt;
+        pid->maxOut = max_tilt;
+    }
+    azmPid.Reset((double)azimuth/FIX(1));
+    elvPid.Reset((double)elevation/FIX(1));
+    lastUpdate = std::chrono::steady_clock::now();
+    homeAzm = azimuth;
+    homeElv = elevation;
+    PredictPose(time(nullptr), ffAzm, ffElv);
+    elvChannel = servos.AddChannel(elv_servo, elevation);
+    azmChannel = servos.AddChannel(azm_servo, azimuth);
+    if (elvChannel < 0 || azmChannel < 0) {
+        printf("No servo channels left for motors %d and %d\n", elv_servo, azm_servo);
+        return -1;
+    }
+    servos.Start();
+    overlay.every = overlayEvery;
+    if (replayFiles.empty()) {
+        overlay.Start(); // only the camera's head has the screen
+        camera.overlay = &overlay;
+        pipeline.reset(new FramePipeline(&camera, frameBuffers, true));
+    } else {
+        files.reset(new PpmSource(replayFiles, false));
+        pipeline.reset(new FramePipeline(files.get(), frameBuffers, false));
+    }
+    if (recordFile) {
+        record = fopen(recordFile, "wb");
+        if (!record) printf("Can't open %s to record to\n", recordFile);
+    }
+    pipeline->Start();
+    if (telemetryAddress) telemetry.Start(telemetryAddress, telemetryPort);
+    if (realTime) GoRealTime();
+    if (calibration.Load(calibrationFile.c_str())) printf("Loaded calibration from %s\n", calibrationFile.c_str());
+    // ring by ring out from the middle, going round each ring
+    for (int i = -scanRings; i <= scanRings; i++) {
+        for (int j = -scanRings; j <= scanRings; j++) scanPoses.push_back(std::make_pair(i*scanStep, j*scanStep));
+    }
+    std::sort(scanPoses.begin(), scanPoses.end(), [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+        int ringA = std::max(abs(a.first), abs(a.second));
+        int ringB = std::max(abs(b.first), abs(b.second));
+        if (ringA != ringB) return ringA < ringB;
+        return atan2(a.second, a.first) < atan2(b.second, b.first);
+    });
+    lastFrame = std::chrono::steady_clock::now();
     return 0;
 }
 
+static int Cores() {
+    int n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// faults in this head's buffers and pins its capture thread, each head's on the next core
+void Tracker::GoRealTime() {
+    int cpu = (captureCpu + head) % Cores();
+    printf("Real-time mode: head %d captures on cpu %d\n", head, cpu);
+    sun.PreFault();
+    PinThread(pipeline->NativeHandle(), cpu);
+    if (fifoPriority > 0) MakeFifo(pipeline->NativeHandle(), fifoPriority);
+}
+
+// Once for the whole process: locks memory and pins the threads every head shares, the
+// servo thread and whichever run the detection, this one or else each of pool's workers on
+// its own core from visionCpu. The workers pre-fault their own stacks as they start.
+void Tracker::RealTimeThreads(WorkPool* pool) {
+    LockMemory();
+    PinThread(servos.NativeHandle(), servoCpu);
+    // the servo thread wakes briefly 50 times a second and must never wait on a frame
+    if (fifoPriority > 0) MakeFifo(servos.NativeHandle(), fifoPriority + 1);
+    if (!pool) {
+        printf("Real-time mode: vision on cpu %d, servos on cpu %d\n", visionCpu, servoCpu);
+        PreFaultStack();
+        PinThread(pthread_self(), visionCpu);
+        if (fifoPriority > 0) MakeFifo(pthread_self(), fifoPriority);
+        return;
+    }
+    printf("Real-time mode: workers on cpus from %d, servos on cpu %d\n", visionCpu, servoCpu);
+    for (int i = 0; i < pool->Size(); i++) {
+        PinThread(pool->NativeHandle(i), (visionCpu + i) % Cores());
+        if (fifoPriority > 0) MakeFifo(pool->NativeHandle(i), fifoPriority);
+    }
+}
+
+// stops this head's threads; the servo thread and the logger are shared, main() stops those
+void Tracker::Shutdown() {
+    if (pipeline) pipeline->Stop();
+    if (record) fclose(record);
+    overlay.Stop();
+    telemetry.Stop();
+}
+
+// prints how steady this head's loop ran, once everything has stopped
+void Tracker::Report(const char* name) {
+    framePeriod.Print(name);
+    if (telemetryAddress) printf("Telemetry sent: %ld dropped: %ld\n", telemetry.Sent(), telemetry.Dropped());
+}
+
+// hands the new pose to the servo thread, which slews there on its own
 void Tracker::SetMotors() {
-    set_motors(elv_servo, elevation);
-    set_motors(azm_servo, azimuth);
-    hardware_exchange();
-}
-
-int Tracker::MeasureSun() {
-    take_picture();
-    update_screen();
-    /* CONVOLUTION */
-    char edges[CAMERA_HEIGHT][CAMERA_WIDTH]; // array stores edge detected values
-    int diamCount = 0;
-    double diameter = 0;
-    for (int row = 0; row<CAMERA_HEIGHT; row++) {
-        diamCount = 0;
-        for (int col = 0; col<CAMERA_WIDTH; col++) {
-            int red = get_pixel(row, col, 0);
-            int grn = get_pixel(row, col, 1);
-            // sun diameter detection
-            if ((float)grn/(float)red < 0.4) {
-                diamCount++;
-            } else {
-                if (diamCount > diameter) diameter=diamCount;
-                diamCount = 0;
-            }
-            int setting = 2; // convolve blueness vals
-            if (row>0 && col>0 && row<CAMERA_HEIGHT-2 && col<CAMERA_WIDTH-2) { // convolve using Sobel kernels
-                // vertical edge detect
-                double sobelX = -get_pixel(row-1,col-1,setting) + get_pixel(row-1,col+1,setting) -
-                                2.0*(get_pixel(row, col-1,setting)) + 2.0*(get_pixel(row, col+1,setting)) -
-                                get_pixel(row+1,col-1,setting) + get_pixel(row+1,col+1,setting);
-                // horizontal edge detect
-                double sobelY = -get_pixel(row-1,col-1,setting) - 2.0*get_pixel(row-1,col,setting) - (get_pixel(row-1, col+1,setting)) +
-                                (get_pixel(row+1, col-1,setting)) + 2.0*(get_pixel(row+1,col,setting)) + get_pixel(row+1,col+1,setting);
-                edges[row][col] = 0;
-                if (fabs(sobelX)+fabs(sobelY) > convThreshold) edges[row][col] = 1;
-            } else {
-                edges[row][col] = 0;
-            }
-        }
+    servos.SetTarget(elvChannel, elevation);
+    servos.SetTarget(azmChannel, azimuth);
+}
+
+// takes the next captured frame, one captured after the given time if there is one
+bool Tracker::GrabFrame(std::chrono::steady_clock::time_point after) {
+    TIME_STAGE(STAGE_WAIT);
+    frame = pipeline->Next(after);
+    if (!frame) {
+        finished = true;
+        return false;
     }
-    int radius = diameter*0.51;
-    if (radius > 50) radiusRange = 8;
-    else radiusRange = 5;
-    printf("radius: %d\n",radius);
-
-    /* ACCUMULATION/VOTING */
-    int votes[320][240];
-    for (int y=0; y<CAMERA_HEIGHT; y++) { // clear array
-        for (int x=0; x<CAMERA_WIDTH; x++) {
-            votes[x][y] = 0;
-            // fill in gaps where we're confident there's an edge
-            if ((edges[y-1][x] == 1 && edges[y+1][x] == 1) || (edges [y][x-1] == 1 && edges [y][x+1] == 1)) {
-                edges[y][x] = 1;
-            }
-        }
+    if (record) RecordFrame(record, frame);
+    return true;
+}
+
+// rowsAdded: the frame has already been through sun.AddRows(), only Finish() is left
+int Tracker::DetectSun(bool rowsAdded) {
+    int found = rowsAdded ? sun.Finish() : sun.Detect(frame);
+    COUNT_STAT(COUNT_FRAMES, 1);
+    if (found) COUNT_STAT(COUNT_DETECTIONS, 1);
+    {
+        TIME_STAGE(STAGE_OVERLAY);
+        overlay.Offer(frame, sun.edges, sun.maxedX, sun.maxedY);
     }
-    for (int y=0; y<CAMERA_HEIGHT; y++) {
-        for (int x=0; x<CAMERA_WIDTH; x++) {
-            unsigned char red = get_pixel(y, x, 0);
-            unsigned char green = get_pixel(y, x, 1);
-            if (edges[y][x] == 1 && (float)green/(float)red < 0.4) { // if edge-detected and red THEN vote
-                for (int r=radius-radiusRange; r<radius+radiusRange; r++) {
-                    for (int deg=0; deg<360; deg+=degStep) {
-                        int cx = (int) (x - (r * cos(deg*DEG2RAD)));
-                        int cy = (int) (y + (r * sin(deg*DEG2RAD)));
-                        if (cx >= CAMERA_WIDTH || cx < 0 || cy >= CAMERA_HEIGHT || cy < 0) {
-                            continue; // don't look outside camera bounds
-                        }
-                        votes[cx][cy] += 1;
-                    }
-                }
-            }
-        }
+    TelemetryRecord r = {};
+    r.centreX = sun.centreX;
+    r.centreY = sun.centreY;
+    r.radius = sun.radius;
+    r.votes = sun.maxedVote;
+    r.azimuth = azimuth;
+    r.elevation = elevation;
+    r.found = found;
+    r.state = state;
+    telemetry.Publish(r);
+
+    xError = 0;
+    yError = 0;
+    if (!found) return 0;
+
+    // gets signal for how far to adjust servos, from the sub-pixel centre
+    xError = sun.centreX-FIX(CAMERA_WIDTH/2);
+    yError = sun.centreY-FIX(CAMERA_HEIGHT/2);
+    LOG_DEBUG("xError: %.2f yError: %.2f\n", (double)xError/FIX(1), (double)yError/FIX(1));
+    return 1;
+}
+
+// detects the sun in the next frame, or the next captured after the given time
+int Tracker::MeasureSun(std::chrono::steady_clock::time_point after) {
+    if (streamRows) return StreamSun(after);
+    if (!GrabFrame(after)) return 0;
+    return DetectSun();
+}
+
+// MeasureSun() on a frame that may still be coming in, working on each band of rows as it
+// arrives so that only the tally is left once the last row is in
+int Tracker::StreamSun(std::chrono::steady_clock::time_point after) {
+    {
+        TIME_STAGE(STAGE_WAIT);
+        frame = pipeline->NextStreaming(after);
     }
-    update_screen();
-
-    /* TALLY THE VOTES */
-    int maxedX = 0;
-    int maxedY = 0;
-    int maxedVote = 0;
-    for (int y=1; y<CAMERA_HEIGHT-1; y++) {
-        for (int x = 1; x < CAMERA_WIDTH - 1; x++) {
-			bool isLeftCorner = false;
-			bool isRightCorner = false;
-
-            int squareX = x-radius+3; // ignore shapes with a top left square corner
-            int squareY = y-radius+3;
-            if (squareX > 0 && squareY > 0) {
-				int red = get_pixel(squareY, squareX, 0);
-				int grn = get_pixel(squareY, squareX, 1);
-				if ((float)grn/(float)red < 0.4 && edges[squareY][squareX] == 1) isLeftCorner = true;
-			}
-            
-            squareX = x+radius-3; // move to bottom right corner
-            squareY = y+radius-3;
-            if (squareX < 240 && squareY < 240) {
-				int red = get_pixel(squareY, squareX, 0);
-				int grn = get_pixel(squareY, squareX, 1);
-				if ((float)grn/(float)red < 0.4 && edges[squareY][squareX] == 1) isRightCorner = true;
-			}
-            if (isLeftCorner && isRightCorner) continue;
-
-            if (votes[x][y] > maxedVote) {
-                maxedVote = votes[x][y];
-                maxedX = x;
-                maxedY = y;
-            }
+    if (!frame) {
+        finished = true;
+        return 0;
+    }
+    sun.Begin(true);
+    int rows = 0;
+    while (rows < CAMERA_HEIGHT) {
+        rows = pipeline->WaitRows(rows);
+        if (rows < 0) {
+            finished = true;
+            return 0;
         }
+        sun.AddRows(frame, rows);
     }
-    printf("x: %d y: %d votes: %d\n", maxedX, maxedY, maxedVote);
+    if (record) RecordFrame(record, frame);
+    return DetectSun(true);
+}
 
-    // count how many red pixels in middle
-    diamCount = 0;
-    diameter = 0;
-    for (int r=0; r<CAMERA_HEIGHT; r++) {
-        int red = get_pixel(r, maxedX, 0);
-        int grn = get_pixel(r, maxedX, 1);
-        if ((float) grn / (float) red < 0.4) {
-            diamCount++;
-        } else {
-            if (diamCount > diameter) diameter=diamCount;
-            diamCount = 0;
-        }
+// blocks until the servo thread has the servos on target, then lets the camera catch up;
+// frames captured from the time returned show the new pose
+std::chrono::steady_clock::time_point Tracker::WaitForServos(int settleMs) {
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    } while (!servos.Settled(elvChannel) || !servos.Settled(azmChannel));
+    std::this_thread::sleep_for(std::chrono::milliseconds(settleMs));
+    return std::chrono::steady_clock::now();
+}
+
+// notes where the sun is, for the local search if it's lost again
+void Tracker::SeenSun() {
+    if (state != TRACKING) {
+        LOG_INFO("Found the sun again\n");
+        sun.ClearRoi();
+        state = TRACKING;
     }
+    lastX = sun.maxedX;
+    lastY = sun.maxedY;
+    lastRadius = sun.radius;
+    seenTime = time(nullptr);
+    seenAzm = azimuth;
+    seenElv = elevation;
+}
+
+// Servo pose (in steps, not fixed-point) that points at the sun at time t. The servos
+// span 180 degrees over min_tilt..max_tilt, as the Deg print assumes, and like the PID
+// a bigger value turns the camera right (clockwise) and down.
+void Tracker::PredictPose(time_t t, double& azm, double& elv) const {
+    double sunAzm, sunElv;
+    ephemeris.SunPosition(t, sunAzm, sunElv);
+    double stepsPerDeg = (max_tilt - min_tilt)/180.0;
+    double bearing = fmod(sunAzm - mountHeading + 540.0, 360.0) - 180.0; // -180..180 from the mount
+    azm = (double)homeAzm/FIX(1) + bearing*stepsPerDeg;
+    elv = (double)homeElv/FIX(1) - (sunElv - mountAltitude)*stepsPerDeg;
+}
+
+// servo steps the sun has moved since it was last seen; differences of predictions, so
+// how the rig was set down doesn't matter
+void Tracker::PredictedShift(double& dAzm, double& dElv) const {
+    double azmThen, elvThen, azmNow, elvNow;
+    PredictPose(seenTime, azmThen, elvThen);
+    PredictPose(time(nullptr), azmNow, elvNow);
+    dAzm = azmNow - azmThen;
+    dElv = elvNow - elvThen;
+}
 
-    // set convolutional result only after getting pixel vals
-    for (int y=0; y<CAMERA_HEIGHT; y++) {
-        for (int x=0; x<CAMERA_WIDTH; x++) {
-            if (edges[y][x] == 1) set_pixel(y,x,255,255,255);
-            else set_pixel(y,x,0,0,0);
+// moves the servos (and the PIDs with them) along with the predicted sun, in whole
+// fixed-point units so the slow drift isn't rounded away frame after frame
+void Tracker::FeedForward() {
+    double azm, elv;
+    PredictPose(time(nullptr), azm, elv);
+    int dAzm = lround((azm - ffAzm)*FIX(1));
+    int dElv = lround((elv - ffElv)*FIX(1));
+    ffAzm += (double)dAzm/FIX(1);
+    ffElv += (double)dElv/FIX(1);
+    if (!useEphemeris || (dAzm == 0 && dElv == 0)) return;
+    azimuth += dAzm;
+    elevation += dElv;
+    azmPid.Shift((double)dAzm/FIX(1));
+    elvPid.Shift((double)dElv/FIX(1));
+}
+
+void Tracker::StartScan() {
+    sun.ClearRoi();
+    sun.ClearHistory();
+    state = SCANNING;
+    scanAzm = azimuth;
+    scanElv = elevation;
+    if (useEphemeris) {
+        // start where the sun should be by now: its last pose moved on with the sky, or
+        // straight from the mount's heading if it's never been seen
+        double azm, elv;
+        if (seenTime != 0) {
+            PredictedShift(azm, elv);
+            azm += (double)seenAzm/FIX(1);
+            elv += (double)seenElv/FIX(1);
+        } else {
+            PredictPose(time(nullptr), azm, elv);
         }
+        scanAzm = lround(azm*FIX(1));
+        scanElv = lround(elv*FIX(1));
+        if (scanAzm > FIX(max_tilt)) scanAzm = FIX(max_tilt);
+        if (scanAzm < FIX(min_tilt)) scanAzm = FIX(min_tilt);
+        if (scanElv > FIX(max_tilt)) scanElv = FIX(max_tilt);
+        if (scanElv < FIX(min_tilt)) scanElv = FIX(min_tilt);
+        azimuth = scanAzm;
+        elevation = scanElv;
+        SetMotors();
     }
-    // mark voted centre
-    for (int i = -2; i<2; i++) {
-        for (int j = -2; j<2; j++) {
-            set_pixel(maxedY+i, maxedX+j, 255,0,0);
-        }
+    LOG_INFO("Scanning for the sun from E: %d A: %d\n", Servo(scanElv), Servo(scanAzm));
+    scanIndex = 0;
+    // the pose it was lost at has been looked at already, a predicted one hasn't
+    if (!useEphemeris) NextScanPose();
+}
+
+// moves to the next pose of the spiral inside the servo limits, starting over after the last
+void Tracker::NextScanPose() {
+    int azm, elv;
+    do {
+        scanIndex = (scanIndex + 1) % scanPoses.size();
+        azm = scanAzm + FIX(scanPoses[scanIndex].first);
+        elv = scanElv + FIX(scanPoses[scanIndex].second);
+    } while (azm < FIX(min_tilt) || azm > FIX(max_tilt) || elv < FIX(min_tilt) || elv > FIX(max_tilt));
+    azimuth = azm;
+    elevation = elv;
+    SetMotors();
+    sun.ClearHistory();
+}
+
+// one scan pose: the full detection only runs if there's enough red in view to be the sun
+void Tracker::ScanStep() {
+    if (!GrabFrame(WaitForServos(scanSettleMs))) return;
+    int area = sun.RedArea(frame, 4);
+    LOG_DEBUG("Scan pose %d/%d red: %d\n", scanIndex, (int)scanPoses.size(), area);
+    if (area >= scanMinRed && DetectSun()) {
+        SeenSun();
+        elvPid.Reset((double)elevation/FIX(1));
+        azmPid.Reset((double)azimuth/FIX(1));
+        lastUpdate = std::chrono::steady_clock::now();
+        PredictPose(time(nullptr), ffAzm, ffElv); // the scan already did the feeding forward
+        return;
     }
-    xError = 0;
-    yError = 0;
-    
-    update_screen();
-    if (edges[maxedY][maxedX] == 1) {
-		printf("Half circle\n");
-		return 0;
-	} else if (maxedY>CAMERA_HEIGHT-radius/2 || maxedY<radius/2) {
-		printf("Out of bounds\n");
-		return 0;
-	} else if (maxedVote<voteThr) {
-		printf("Not enough votes\n");
-		return 0;
-	} else if (abs(diameter/2-radius) > 5) {
-		printf("No middle red line\n");
-		return 0;
-	} 
-
-    update_screen();
-
-    // gets signal for how far to adjust servos
-    xError = kp*(maxedX-CAMERA_WIDTH/2.0);
-    yError = kp*(maxedY-CAMERA_HEIGHT/2.0);
-    printf("xError: %d yError: %d\n", xError, yError);
-    return 1;
+    NextScanPose();
 }
 
 void Tracker::FollowSun() {
-    int isSunUp = MeasureSun();
-    if (isSunUp) {
-        elevation += yError;
-        if (elevation > max_tilt) elevation = max_tilt;
-        if (elevation < min_tilt) elevation = min_tilt;
-        azimuth += xError;
-        if (azimuth > max_tilt) azimuth = max_tilt;
-        if (azimuth < min_tilt) azimuth = min_tilt;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    framePeriod.Record(std::chrono::duration_cast<std::chrono::microseconds>(start - lastFrame).count());
+    lastFrame = start;
+    TIME_STAGE(STAGE_FRAME);
+    COLLECT_STATS();
+    DUMP_STATS_IF_ASKED();
+    if (state == SCANNING) {
+        ScanStep();
+        return;
+    }
+    FeedForward();
+    // frames already taken after a jump still show the sun where it was, and would jump again
+    int isSunUp;
+    if (jumped) {
+        std::chrono::steady_clock::time_point settled = WaitForServos(jumpSettleMs);
+        isSunUp = MeasureSun(settled);
+        lastUpdate = settled; // the PID starts again from the pose jumped to
+        jumped = false;
     } else {
-        printf("No sun detected, resetting\n");
-        elevation = 51;
-        azimuth = 55;
+        isSunUp = MeasureSun();
+    }
+    if (finished) return;
+    // real time since the last frame; clamped so a stall can't dump a huge step into the integral
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double dt = std::chrono::duration<double>(now - lastUpdate).count();
+    lastUpdate = now;
+    if (dt < 0.001) dt = 0.001;
+    if (dt > 3.0) dt = 3.0;
+    TIME_STAGE(STAGE_CONTROL);
+    double ex = (double)xError/FIX(1);
+    double ey = (double)yError/FIX(1);
+    if (isSunUp) SeenSun();
+    if (isSunUp && calibration.loaded && ex*ex + ey*ey > jumpError*jumpError) {
+        // far off: one absolute move that lands on the sun, then the PID carries on from there
+        double dAzm, dElv;
+        calibration.Lookup(ex, ey, dAzm, dElv);
+        azimuth += lround(dAzm*FIX(1));
+        elevation += lround(dElv*FIX(1));
+        if (elevation > FIX(max_tilt)) elevation = FIX(max_tilt);
+        if (elevation < FIX(min_tilt)) elevation = FIX(min_tilt);
+        if (azimuth > FIX(max_tilt)) azimuth = FIX(max_tilt);
+        if (azimuth < FIX(min_tilt)) azimuth = FIX(min_tilt);
+        elvPid.Reset((double)elevation/FIX(1));
+        azmPid.Reset((double)azimuth/FIX(1));
+        sun.ClearHistory(); // the votes so far are for where the sun was
+        jumped = true;
+        LOG_INFO("Jump to sun\n");
+    } else if (isSunUp) {
+        elevation = lround(elvPid.Update(ey, dt)*FIX(1));
+        azimuth = lround(azmPid.Update(ex, dt)*FIX(1));
+    } else if (state == TRACKING && lastRadius > 0) {
+        // hold the pose and look again around where it was, it's likely only been hidden
+        int x = lastX;
+        int y = lastY;
+        if (useEphemeris) {
+            // the servo move it now needs, less what the servos have moved, shows as an
+            // offset in the image the same way round as the PID reads the error
+            double dAzm, dElv;
+            PredictedShift(dAzm, dElv);
+            x += lround((dAzm - (double)(azimuth-seenAzm)/FIX(1))*pixelsPerStep);
+            y += lround((dElv - (double)(elevation-seenElv)/FIX(1))*pixelsPerStep);
+        }
+        int reach = lastRadius + roiMargin;
+        sun.SetRoi(x - reach, y - reach, x + reach, y + reach);
+        state = LOCAL_SEARCH;
+        lostFrames = 0;
+        elvPid.Reset((double)elevation/FIX(1));
+        azmPid.Reset((double)azimuth/FIX(1));
+        LOG_INFO("Lost the sun, looking near %d %d\n", lastX, lastY);
+    } else if (state == TRACKING || ++lostFrames >= localFrames) {
+        StartScan();
+        return;
+    }
+    double degrees = ((double)(elevation-FIX(min_tilt))/FIX(max_tilt-min_tilt))*180.0-90.0;
+    LOG_DEBUG("E: %d A: %d Deg: %1.2f\n", Servo(elevation), Servo(azimuth),degrees);
+    SetMotors();
+}
+
+// Sweeps the servos around the current pose with the sun in view, notes how far each
+// move shifts the sun, and saves the fitted pixel-to-servo table.
+int Tracker::Calibrate() {
+    printf("Calibrating, keep the sun still and in view\n");
+    if (!MeasureSun()) {
+        printf("Can't see the sun to calibrate\n");
+        return -1;
+    }
+    int homeX = sun.centreX;
+    int homeY = sun.centreY;
+    int homeAzm = azimuth;
+    int homeElv = elevation;
+    for (int da = -calSpan; da <= calSpan; da += calStep) {
+        for (int de = -calSpan; de <= calSpan; de += calStep) {
+            azimuth = homeAzm + FIX(da);
+            elevation = homeElv + FIX(de);
+            if (azimuth < FIX(min_tilt) || azimuth > FIX(max_tilt)) continue;
+            if (elevation < FIX(min_tilt) || elevation > FIX(max_tilt)) continue;
+            SetMotors();
+            if (!MeasureSun(WaitForServos(calSettleMs))) {
+                printf("Lost the sun at %d %d, skipping\n", da, de);
+                continue;
+            }
+            calibration.AddSample((double)(sun.centreX-homeX)/FIX(1), (double)(sun.centreY-homeY)/FIX(1),
+                                  (double)(azimuth-homeAzm)/FIX(1), (double)(elevation-homeElv)/FIX(1));
+        }
     }
-    double degrees = ((double)(elevation-min_tilt)/(max_tilt-min_tilt))*180.0-90.0;
-    printf("E: %d A: %d Deg: %1.2f\n", elevation, azimuth,degrees);
+    azimuth = homeAzm;
+    elevation = homeElv;
     SetMotors();
+    if (!calibration.Fit()) {
+        printf("Not enough sightings to calibrate\n");
+        return -1;
+    }
+    if (!calibration.Save(calibrationFile.c_str())) return -1;
+    printf("Saved calibration to %s\n", calibrationFile.c_str());
+    return 0;
+}
+
+// logging (logger.h), one log for every head: the loop's messages are printed by a background thread
+static int logLevel = LEVEL_DEBUG; // LEVEL_INFO drops the per frame detail
+static int logRate = 0; // messages per second from any one log statement, 0 for no limit
+static const char* logFile = nullptr; // append to this file instead of the terminal
+
+// once, before any head's threads can log
+static void StartLogging() {
+    Logger::Global().level = logLevel;
+    Logger::Global().rateLimit = logRate;
+    FILE* log = logFile ? fopen(logFile, "a") : nullptr;
+    if (logFile && !log) printf("Can't open %s, logging to the terminal\n", logFile);
+    Logger::Global().Start(log ? log : stdout);
+}
+
+static volatile sig_atomic_t stopping = 0;
+
+static void Stop(int) { stopping = 1; }
+
+// Every head's frames as tasks on the pool, each head queueing its next frame when one's
+// done, until they've all finished or been stopped.
+static void RunOnPool(std::vector<std::unique_ptr<Tracker> >& heads, WorkPool& pool) {
+    std::atomic<int> active{(int)heads.size()};
+    std::atomic<bool> stop{false}; // stopping, passed on from the thread the signal lands on
+    std::function<void(Tracker*)> step = [&](Tracker* dt) {
+        if (stop || dt->Finished()) {
+            active--;
+            return;
+        }
+        dt->FollowSun();
+        pool.Submit([&step, dt] { step(dt); });
+    };
+    for (size_t i = 0; i < heads.size(); i++) {
+        Tracker* dt = heads[i].get();
+        pool.Submit([&step, dt] { step(dt); });
+    }
+    while (active > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        if (stopping) stop = true;
+    }
+    pool.Stop();
 }
 
-int main() {
-    Tracker dt;
-    dt.InitHardware();
-    while (true) {
-        dt.FollowSun();
+// stops every head and the shared threads, then prints how steady the loops ran
+static void Shutdown(std::vector<std::unique_ptr<Tracker> >& heads, ServoScheduler& servos) {
+    for (size_t i = 0; i < heads.size(); i++) heads[i]->Shutdown();
+    servos.Stop();
+    Logger::Global().Stop();
+    for (size_t i = 0; i < heads.size(); i++) {
+        std::string name = heads.size() == 1 ? "Frame period" : "Head " + std::to_string(i) + " frame period";
+        heads[i]->Report(name.c_str());
+    }
+    servos.lateness.Print("Servo tick lateness");
+    printf("Servo exchanges: %ld idle ticks: %ld\n", servos.Exchanges(), servos.IdleTicks());
+    DUMP_STATS();
+}
+
+int main(int argc, char* argv[]) {
+    ServoScheduler servos;
+    servos.fixBits = FIX_BITS;
+    std::vector<std::unique_ptr<Tracker> > heads;
+    heads.emplace_back(new Tracker(servos, 0));
+    bool calibrate = false;
+    bool realTime = false;
+    int workers = 0; // pool threads for several heads, 0 for one per core
+    for (int i = 1; i < argc; i++) {
+        Tracker& dt = *heads.back(); // the rest apply to the latest head
+        if (strcmp(argv[i], "calibrate") == 0) calibrate = true;
+        else if (strcmp(argv[i], "realtime") == 0) realTime = true;
+        else if (strcmp(argv[i], "workers") == 0 && i+1 < argc) workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "head") == 0) heads.emplace_back(new Tracker(servos, heads.size()));
+        else if (strcmp(argv[i], "servos") == 0 && i+2 < argc) {
+            dt.UseServos(atoi(argv[i+1]), atoi(argv[i+2]));
+            i += 2;
+        }
+        else if (strcmp(argv[i], "record") == 0 && i+1 < argc) dt.RecordTo(argv[++i]);
+        else if (strcmp(argv[i], "stream") == 0) dt.StreamRows(true);
+        else if (strcmp(argv[i], "telemetry") == 0 && i+1 < argc) dt.SendTelemetry(argv[++i]);
+        else if (strcmp(argv[i], "replay") == 0) {
+            // the files up to the next head are the ones to replay
+            std::vector<std::string> files;
+            while (i+1 < argc && strcmp(argv[i+1], "head") != 0) files.push_back(argv[++i]);
+            dt.Replay(files);
+        }
+    }
+    int cameras = 0;
+    for (size_t i = 0; i < heads.size(); i++) cameras += heads[i]->UsesCamera();
+    if (cameras > 1) {
+        printf("There's only one camera, give the other heads files to replay\n");
+        return 1;
+    }
+    init(0);
+    open_screen_stream(); // before the camera head's overlay can draw on it
+    StartLogging();
+    for (size_t i = 0; i < heads.size(); i++) {
+        heads[i]->UseRealTime(realTime);
+        if (heads[i]->InitHardware() != 0) {
+            Shutdown(heads, servos);
+            return 1;
+        }
+    }
+    // the detection runs on this thread, unless there's a pool for it
+    bool onPool = heads.size() > 1 || workers > 0;
+    if (realTime && (calibrate || !onPool)) heads[0]->RealTimeThreads(nullptr);
+    if (calibrate) {
+        int res = 0;
+        for (size_t i = 0; i < heads.size() && res == 0; i++) res = heads[i]->Calibrate();
+        Shutdown(heads, servos);
+        return res;
+    }
+    // Ctrl-C finishes the frame and prints the timing before exiting
+    signal(SIGINT, Stop);
+    signal(SIGTERM, Stop);
+    signal(SIGUSR1, Stats::RequestDump); // kill -USR1 prints the stats without stopping
+    signal(SIGUSR2, Overlay::Request); // kill -USR2 draws the overlay on the next frame
+    if (!onPool) {
+        Tracker& dt = *heads[0];
+        while (!stopping && !dt.Finished()) {
+            dt.FollowSun();
+        }
+    } else {
+        WorkPool pool;
+        if (realTime) pool.onStart = [](int) { PreFaultStack(); };
+        pool.Start(workers);
+        if (realTime) heads[0]->RealTimeThreads(&pool);
+        printf("%d heads on %d workers\n", (int)heads.size(), pool.Size());
+        RunOnPool(heads, pool);
+        printf("Work stolen: %ld times\n", pool.Steals());
     }
+    Shutdown(heads, servos);
     return 0;
 }
@@ -0,0 +1,171 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// The live screen: the camera's view, with the debug overlay (edge map and voted centre)
+// drawn over it every Nth frame or when asked (SIGUSR2). The vision loop's only part is
+// one copy of the frame and its edge map on frames that are annotated; a low priority
+// thread draws them into its own image and puts that, or else the plain camera frame, on
+// the screen. E101 draws through set_pixel() into the camera's own buffer and shows that,
+// so the thread only touches it under Screen(), which the capture side (frameSource.h)
+// holds while it takes a picture and copies it out.
+
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include "E101.h"
+#include "realtime.h"
+
+#ifndef CAMERA_WIDTH
+#define CAMERA_WIDTH 320 //Control Resolution from Camera
+#define CAMERA_HEIGHT 240 //Control Resolution from Camera
+#endif
+
+class Overlay {
+public:
+    int every = 5; // annotate every Nth frame, 0 for only when asked
+
+    void Start() {
+        running = true;
+        worker = std::thread(&Overlay::Run, this);
+        MakeLowPriority(worker.native_handle());
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            running = false;
+        }
+        cv.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+
+    ~Overlay() { Stop(); }
+
+    // Takes a detected frame (packed RGB), its edges and centre if it's one to annotate.
+    // Returns straight away, and skips the frame if the last one hasn't made it to the
+    // screen yet.
+    void Offer(const unsigned char* frame, const char edges[CAMERA_HEIGHT][CAMERA_WIDTH], int x, int y);
+
+    // From the thread that calls take_picture(), once a frame is copied out: the camera's
+    // buffer holds a new picture for the screen. Never waits.
+    void CameraFrame();
+
+    // held around anything that uses the camera's buffer: take_picture(), get_pixel(),
+    // set_pixel() and update_screen()
+    std::mutex& Screen() { return screen; }
+
+    // SIGUSR2 handler, annotates the next frame whatever every is
+    static void Request(int) { Requested() = 1; }
+
+private:
+    enum { IDLE, PENDING, RENDERING }; // states of the one annotated frame in flight
+    std::thread worker;
+    std::mutex m;
+    std::condition_variable cv;
+    std::mutex screen;
+    bool running = false;
+    bool fresh = false; // a camera frame the screen hasn't shown
+    std::atomic<int> state{IDLE};
+    long frames = 0;
+    unsigned char camera[CAMERA_HEIGHT][CAMERA_WIDTH][3];
+    char edges[CAMERA_HEIGHT][CAMERA_WIDTH];
+    int centreX = 0, centreY = 0;
+    unsigned char image[CAMERA_HEIGHT][CAMERA_WIDTH][3];
+
+    static volatile sig_atomic_t& Requested() {
+        static volatile sig_atomic_t flag = 0;
+        return flag;
+    }
+
+    void Render();
+    void Show(bool annotated);
+    void Run();
+};
+
+inline void Overlay::Offer(const unsigned char* frame, const char e[CAMERA_HEIGHT][CAMERA_WIDTH], int x, int y) {
+    frames++;
+    bool show = (every > 0 && frames % every == 0) || Requested();
+    if (!show || !running || state != IDLE) return;
+    Requested() = 0;
+    memcpy(camera, frame, sizeof(camera));
+    memcpy(edges, e, sizeof(edges));
+    centreX = x;
+    centreY = y;
+    {
+        std::lock_guard<std::mutex> lock(m);
+        state = PENDING;
+    }
+    cv.notify_all();
+}
+
+inline void Overlay::CameraFrame() {
+    {
+        std::lock_guard<std::mutex> lock(m);
+        fresh = true;
+    }
+    cv.notify_all();
+}
+
+// the camera frame, its edges in green and the voted centre in red
+inline void Overlay::Render() {
+    memcpy(image, camera, sizeof(image));
+    for (int y = 0; y < CAMERA_HEIGHT; y++) {
+        for (int x = 0; x < CAMERA_WIDTH; x++) {
+            if (edges[y][x] != 1) continue;
+            image[y][x][0] = 0;
+            image[y][x][1] = 255;
+            image[y][x][2] = 0;
+        }
+    }
+    for (int i = -2; i < 2; i++) {
+        for (int j = -2; j < 2; j++) {
+            int y = centreY + i;
+            int x = centreX + j;
+            if (y < 0 || x < 0 || y >= CAMERA_HEIGHT || x >= CAMERA_WIDTH) continue;
+            image[y][x][0] = 255;
+            image[y][x][1] = 0;
+            image[y][x][2] = 0;
+        }
+    }
+}
+
+// The annotated image, or whatever picture the camera's buffer holds. The capture thread
+// may be waiting on screen, so this thread holds it at normal priority, never starved.
+inline void Overlay::Show(bool annotated) {
+    MakeNormalPriority(pthread_self());
+    {
+        std::lock_guard<std::mutex> lock(screen);
+        if (annotated) {
+            for (int y = 0; y < CAMERA_HEIGHT; y++) {
+                for (int x = 0; x < CAMERA_WIDTH; x++) set_pixel(y, x, image[y][x][0], image[y][x][1], image[y][x][2]);
+            }
+        }
+        update_screen();
+    }
+    MakeLowPriority(pthread_self());
+}
+
+inline void Overlay::Run() {
+    while (true) {
+        bool annotate;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [this] { return state == PENDING || fresh || !running; });
+            if (!running) return;
+            annotate = state == PENDING;
+            if (annotate) state = RENDERING;
+            fresh = false;
+        }
+        if (annotate) Render();
+        Show(annotate);
+        if (annotate) state = IDLE;
+    }
+}
+
+#endif
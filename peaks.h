@@ -0,0 +1,106 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Picks the best few circle centres out of the vote accumulator instead of only the
+// single highest cell, so a frame whose top peak is a square corner or a half circle
+// can fall through to the next best circle rather than being thrown away.
+
+#ifndef PEAKS_H
+#define PEAKS_H
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#ifndef CAMERA_WIDTH
+#define CAMERA_WIDTH 320 //Control Resolution from Camera
+#define CAMERA_HEIGHT 240 //Control Resolution from Camera
+#endif
+
+struct Peak {
+    int x, y;
+    int votes;
+    int radius; // of the circle the votes were cast for
+    bool operator>(const Peak& p) const { return votes > p.votes; }
+};
+
+class PeakFinder {
+public:
+    // Appends up to k local maxima of votes inside the box to out, best first, no two
+    // closer than spacing pixels.
+    void Find(const int votes[CAMERA_WIDTH][CAMERA_HEIGHT], int minX, int minY, int maxX, int maxY,
+              int k, int spacing, int radius, std::vector<Peak>& out);
+
+private:
+    static const int chunk = 8; // cells whose max is taken in one go before any peak test
+    std::priority_queue<Peak, std::vector<Peak>, std::greater<Peak> > heap; // min-heap
+    std::vector<Peak> found;
+};
+
+// One pass down each column of the accumulator. The max of every chunk of cells is
+// compared with the weakest peak kept so far (a plain loop the compiler vectorizes),
+// and only chunks that beat it get the 3x3 local maximum test. The bounded min-heap
+// keeps a few more peaks than asked for, since suppression then thins them out.
+inline void PeakFinder::Find(const int votes[CAMERA_WIDTH][CAMERA_HEIGHT], int minX, int minY, int maxX, int maxY,
+                             int k, int spacing, int radius, std::vector<Peak>& out) {
+    if (minX < 1) minX = 1;
+    if (minY < 1) minY = 1;
+    if (maxX > CAMERA_WIDTH-2) maxX = CAMERA_WIDTH-2;
+    if (maxY > CAMERA_HEIGHT-2) maxY = CAMERA_HEIGHT-2;
+    size_t capacity = 4*k;
+    heap = std::priority_queue<Peak, std::vector<Peak>, std::greater<Peak> >();
+    for (int x = minX; x <= maxX; x++) {
+        const int* col = votes[x];
+        for (int y0 = minY; y0 <= maxY; y0 += chunk) {
+            int n = maxY - y0 + 1 < chunk ? maxY - y0 + 1 : chunk;
+            int m = 0;
+            for (int i = 0; i < n; i++) m = col[y0+i] > m ? col[y0+i] : m;
+            int floor = heap.size() < capacity ? 0 : heap.top().votes;
+            if (m <= floor) continue;
+            for (int y = y0; y < y0 + n; y++) {
+                int v = col[y];
+                if (v <= floor) continue;
+                bool isMax = true;
+                for (int dx = -1; dx <= 1 && isMax; dx++) {
+                    for (int dy = -1; dy <= 1; dy++) {
+                        if (votes[x+dx][y+dy] > v) {
+                            isMax = false;
+                            break;
+                        }
+                    }
+                }
+                if (!isMax) continue;
+                Peak p = {x, y, v, radius};
+                heap.push(p);
+                if (heap.size() > capacity) heap.pop();
+                floor = heap.size() < capacity ? 0 : heap.top().votes;
+            }
+        }
+    }
+
+    // non-maximum suppression, strongest first
+    found.clear();
+    while (!heap.empty()) {
+        found.push_back(heap.top());
+        heap.pop();
+    }
+    int kept = 0;
+    for (int i = found.size()-1; i >= 0 && kept < k; i--) {
+        const Peak& p = found[i];
+        bool suppressed = false;
+        for (int j = out.size()-kept; j < (int)out.size(); j++) {
+            int dx = out[j].x - p.x;
+            int dy = out[j].y - p.y;
+            if (dx*dx + dy*dy < spacing*spacing) {
+                suppressed = true;
+                break;
+            }
+        }
+        if (suppressed) continue;
+        out.push_back(p);
+        kept++;
+    }
+}
+
+#endif
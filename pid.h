@@ -0,0 +1,63 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// PID controller for one servo axis. ki and kd are per second and every update is given
+// the real time since the last one, so the integral and derivative behave the same whether
+// a frame takes half a second or two. kp has no time in it: the output is a servo position,
+// and kp*error is an offset on it from this frame's error alone, not a step added each frame.
+
+#ifndef PID_H
+#define PID_H
+
+class Pid {
+public:
+    double kp = 0; // servo steps per pixel of error
+    double ki = 0; // servo steps per pixel per second
+    double kd = 0; // servo steps per pixel per second of error change
+    double derivTau = 0.5; // seconds, low pass on the derivative so pixel noise doesn't kick the servo
+    double minOut = 0; // servo limits, the integral never winds up past them
+    double maxOut = 0;
+
+    // forget the history and carry on from this servo position, so there's no jump
+    void Reset(double output) {
+        integral = output;
+        deriv = 0;
+        primed = false;
+    }
+
+    // moves the output by d servo steps without it counting as error, for feed-forward
+    void Shift(double d) { integral += d; }
+
+    // servo position for this error, dt seconds after the last update
+    double Update(double error, double dt) {
+        double saved = integral;
+        integral += ki*error*dt;
+        if (primed) {
+            double alpha = derivTau/(derivTau + dt);
+            deriv = alpha*deriv + (1 - alpha)*(error - prevError)/dt;
+        }
+        prevError = error;
+        primed = true;
+
+        double out = integral + kp*error + kd*deriv;
+        // anti-windup: stop integrating further into a limit
+        if (out > maxOut) {
+            out = maxOut;
+            if (error > 0) integral = saved;
+        } else if (out < minOut) {
+            out = minOut;
+            if (error < 0) integral = saved;
+        }
+        if (integral > maxOut) integral = maxOut;
+        if (integral < minOut) integral = minOut;
+        return out;
+    }
+
+private:
+    double integral = 0;
+    double prevError = 0;
+    double deriv = 0;
+    bool primed = false;
+};
+
+#endif
@@ -0,0 +1,96 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Binary (P6) PPMs, the frames the tracker records and the PC tools read, and the labels
+// file that says where the sun is in each. The header may hold '#' comments, as written by
+// GIMP and most other tools. Each line of a labels file is a PPM and where the sun is in
+// it, or none:
+//   aSun.ppm 159 117 40   (centre x y, radius)
+//   aMars.ppm none
+// and lines starting with '#' are comments.
+
+#ifndef PPM_H
+#define PPM_H
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct LabelledFrame {
+    std::string name; // the file it came from
+    int width = 0, height = 0;
+    std::vector<unsigned char> pixels; // packed RGB
+    bool sun = false;
+    double x = 0, y = 0, radius = 0; // the labelled sun, if there is one
+};
+
+// Reads the header of the next PPM in fp, up to the single whitespace before the pixels.
+// False at the end of the file, or if it's not an 8 bit P6.
+inline bool ReadPpmHeader(FILE* fp, int& width, int& height) {
+    char ch;
+    if (fscanf(fp, " P%c", &ch) != 1 || ch != '6') return false;
+    int values[3];
+    for (int i = 0; i < 3; i++) {
+        // skip whitespace and comments
+        int c = getc(fp);
+        while (isspace(c) || c == '#') {
+            if (c == '#') {
+                do {
+                    c = getc(fp);
+                } while (c != '\n' && c != EOF);
+            }
+            c = getc(fp);
+        }
+        ungetc(c, fp);
+        if (fscanf(fp, "%d", &values[i]) != 1) return false;
+    }
+    width = values[0];
+    height = values[1];
+    return getc(fp) != EOF && width > 0 && height > 0 && values[2] == 255;
+}
+
+inline bool ReadPPM(const char* filename, LabelledFrame& frame) {
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+        printf("Unable to open file '%s'\n", filename);
+        return false;
+    }
+    bool ok = ReadPpmHeader(fp, frame.width, frame.height);
+    if (ok) {
+        frame.pixels.resize(frame.width*frame.height*3);
+        ok = fread(frame.pixels.data(), 1, frame.pixels.size(), fp) == frame.pixels.size();
+    }
+    fclose(fp);
+    if (!ok) printf("'%s' is not an 8 bit PPM\n", filename);
+    return ok;
+}
+
+// the labelled frames in the file's order; lines that don't read are reported and skipped
+inline bool ReadLabels(const char* fn, std::vector<LabelledFrame>& frames) {
+    FILE* fp = fopen(fn, "r");
+    if (!fp) {
+        printf("Unable to open file '%s'\n", fn);
+        return false;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        char name[400];
+        char rest[16];
+        LabelledFrame frame;
+        if (line[0] == '#' || sscanf(line, "%399s", name) != 1) continue;
+        frame.sun = sscanf(line, "%*s %lf %lf %lf", &frame.x, &frame.y, &frame.radius) == 3;
+        if (!frame.sun && (sscanf(line, "%*s %15s", rest) != 1 || strcmp(rest, "none") != 0)) {
+            printf("Label for %s should be 'x y radius' or 'none'\n", name);
+            continue;
+        }
+        frame.name = name;
+        if (!ReadPPM(name, frame)) continue;
+        frames.push_back(frame);
+    }
+    fclose(fp);
+    return true;
+}
+
+#endif
@@ -0,0 +1,84 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Real-time run mode for the Linux rig: keeps every page of the process in RAM, pins
+// threads to their own cores and optionally puts them on the SCHED_FIFO scheduler, so
+// the screen stream and everything else on the Pi can't preempt the tracker mid-frame.
+// All of it needs root, which the tracker already runs as.
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+// locks everything mapped now and later into RAM, so no page fault ever stalls a frame
+inline bool LockMemory() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        printf("Can't lock memory: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+inline bool PinThread(pthread_t thread, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err != 0) {
+        printf("Can't pin a thread to cpu %d: %s\n", cpu, strerror(err));
+        return false;
+    }
+    return true;
+}
+
+// priority 1..99, higher runs first; a FIFO thread keeps the core until it blocks
+inline bool MakeFifo(pthread_t thread, int priority) {
+    sched_param param;
+    param.sched_priority = priority;
+    int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    if (err != 0) {
+        printf("Can't make a thread SCHED_FIFO: %s\n", strerror(err));
+        return false;
+    }
+    return true;
+}
+
+// runs a thread only when its core has nothing else to do, for work that can wait
+inline bool MakeLowPriority(pthread_t thread) {
+    sched_param param;
+    param.sched_priority = 0;
+    int err = pthread_setschedparam(thread, SCHED_IDLE, &param);
+    if (err != 0) {
+        printf("Can't lower a thread's priority: %s\n", strerror(err));
+        return false;
+    }
+    return true;
+}
+
+// back to the ordinary scheduler, for a low priority thread about to hold a lock others need
+inline bool MakeNormalPriority(pthread_t thread) {
+    sched_param param;
+    param.sched_priority = 0;
+    int err = pthread_setschedparam(thread, SCHED_OTHER, &param);
+    if (err != 0) {
+        printf("Can't restore a thread's priority: %s\n", strerror(err));
+        return false;
+    }
+    return true;
+}
+
+// touches the stack the loop will grow into, so it's faulted in (and locked) up front
+inline void PreFaultStack() {
+    const int size = 256*1024;
+    unsigned char stack[size];
+    memset(stack, 0, size);
+    __asm__ __volatile__("" : : "r"(stack) : "memory"); // keeps the memset from being optimised out
+}
+
+#endif
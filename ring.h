@@ -0,0 +1,47 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Fixed size lock-free ring for one writing thread and one reading thread. Each thread
+// that logs or times anything gets its own, so the hot path never takes a lock or waits:
+// when the ring is full the new entry is dropped and counted instead.
+
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <cstdint>
+
+template <typename T, uint32_t size>
+class SpscRing {
+public:
+    // writer only; false (and counted) if the reader has fallen a whole ring behind
+    bool Push(const T& item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= size) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items[h % size] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // reader only; hands f everything written so far, oldest first, and returns how many
+    template <typename F> int Drain(F f) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        uint32_t h = head.load(std::memory_order_acquire);
+        int n = h - t;
+        for (; t != h; t++) f(items[t % size]);
+        tail.store(t, std::memory_order_release);
+        return n;
+    }
+
+    std::atomic<long> dropped{0};
+
+private:
+    T items[size];
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+};
+
+#endif
@@ -0,0 +1,233 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// FFT engine for the Hough vote. Scattering a ring of votes from every red edge pixel
+// costs edges*rings*angles, which gets expensive for big suns (bigly.ppm). The same
+// accumulator is the edge map convolved with the ring stencil, so it can be computed
+// with FFTs in O(N log N) whatever the radius or number of edges. The twiddles and ring
+// spectra never change once made, so every detector in the process shares them.
+
+#ifndef RING_FFT_H
+#define RING_FFT_H
+
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef CAMERA_WIDTH
+#define CAMERA_WIDTH 320 //Control Resolution from Camera
+#define CAMERA_HEIGHT 240 //Control Resolution from Camera
+#endif
+
+typedef std::complex<double> Complex;
+
+// plain complex product; operator* also handles infinities and NaNs, and is far slower for it
+inline Complex Mul(const Complex& a, const Complex& b) {
+    return Complex(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+}
+
+class RingFft {
+public:
+    // Fills votes with the ring stencil (ringDx, ringDy) summed over every edge pixel,
+    // exactly what the scatter loop would count. reach is the largest |offset| in the
+    // stencil; the stencil's spectrum is cached under the offsets themselves, so a ring
+    // of another size, step or starting angle never gets a stale one.
+    void Vote(const short* edgeX, const short* edgeY, int numEdges,
+              const short* ringDx, const short* ringDy, int ringLen, int reach,
+              int votes[CAMERA_WIDTH][CAMERA_HEIGHT]);
+
+    // true if the stencil's spectrum is cached, so Vote() needn't make it
+    static bool Cached(const short* ringDx, const short* ringDy, int ringLen);
+    // butterflies one Vote() costs for a stencil of this reach, making the kernel if it
+    // isn't cached
+    static double PredictOps(int reach, bool cached);
+
+private:
+    static const int cacheSize = 8; // kernel spectra kept, ~4MB each at the biggest radii
+    struct Kernel {
+        std::vector<short> ringDx; // the stencil it was made from
+        std::vector<short> ringDy;
+        int nx = 0;
+        int ny = 0;
+        std::vector<Complex> spectrum;
+
+        bool Same(const short* dx, const short* dy, int len) const {
+            return (int)ringDx.size() == len && memcmp(ringDx.data(), dx, len*sizeof(short)) == 0
+                   && memcmp(ringDy.data(), dy, len*sizeof(short)) == 0;
+        }
+    };
+    // shared by every RingFft; a kernel stays alive while a Vote() uses it, evicted or not
+    struct KernelCache {
+        std::mutex m;
+        long uses = 0;
+        std::shared_ptr<const Kernel> kernels[cacheSize];
+        long lastUsed[cacheSize] = {};
+    };
+    std::vector<Complex> work;
+    std::vector<Complex> column;
+
+    static KernelCache& Kernels() {
+        static KernelCache cache;
+        return cache;
+    }
+    static int PadSize(int n);
+    static const Complex* Twiddles(int n);
+    void Fft(Complex* a, int n, bool inverse);
+    void FftRows(Complex* a, int nx, int rows, bool inverse);
+    void FftColumns(Complex* a, int nx, int ny, int cols, bool inverse);
+    std::shared_ptr<const Kernel> KernelFor(const short* ringDx, const short* ringDy, int ringLen, int reach);
+};
+
+// smallest power of two that fits n
+inline int RingFft::PadSize(int n) {
+    int size = 1;
+    while (size < n) size <<= 1;
+    return size;
+}
+
+inline double RingFft::PredictOps(int reach, bool cached) {
+    double nx = PadSize(CAMERA_WIDTH + reach);
+    double ny = PadSize(CAMERA_HEIGHT + reach);
+    // forward and inverse each do the camera rows and every padded column
+    double ops = 2.0*(CAMERA_HEIGHT*nx*log2(nx) + nx*ny*log2(ny));
+    // the kernel wraps round the padding, so its transform does every row
+    if (!cached) ops += nx*ny*(log2(nx) + log2(ny));
+    return ops;
+}
+
+inline bool RingFft::Cached(const short* ringDx, const short* ringDy, int ringLen) {
+    KernelCache& cache = Kernels();
+    std::lock_guard<std::mutex> lock(cache.m);
+    for (int i = 0; i < cacheSize; i++) {
+        const Kernel* k = cache.kernels[i].get();
+        if (k && k->Same(ringDx, ringDy, ringLen)) return true;
+    }
+    return false;
+}
+
+inline const Complex* RingFft::Twiddles(int n) {
+    static std::vector<Complex> twiddle[16]; // by log2 of the transform size
+    static std::once_flag made[16];
+    int bits = 0;
+    while ((1 << bits) < n) bits++;
+    std::vector<Complex>& w = twiddle[bits];
+    std::call_once(made[bits], [&w, n] {
+        w.resize(n/2);
+        for (int k = 0; k < n/2; k++) w[k] = std::polar(1.0, -2.0*M_PI*k/n);
+    });
+    return w.data();
+}
+
+// in-place iterative radix-2 FFT of n (a power of two) points, unscaled;
+// the inverse is the forward transform between two conjugations
+inline void RingFft::Fft(Complex* a, int n, bool inverse) {
+    const Complex* w = Twiddles(n);
+    if (inverse) {
+        for (int i = 0; i < n; i++) a[i] = std::conj(a[i]);
+    }
+    for (int i = 1, j = 0; i < n; i++) { // bit reversal permutation
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(a[i], a[j]);
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        int step = n/len;
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < len/2; k++) {
+                Complex u = a[i+k];
+                Complex v = Mul(a[i+k+len/2], w[k*step]);
+                a[i+k] = u+v;
+                a[i+k+len/2] = u-v;
+            }
+        }
+    }
+    if (inverse) {
+        for (int i = 0; i < n; i++) a[i] = std::conj(a[i]);
+    }
+}
+
+inline void RingFft::FftRows(Complex* a, int nx, int rows, bool inverse) {
+    for (int y = 0; y < rows; y++) Fft(a + y*nx, nx, inverse);
+}
+
+// columns go through a contiguous copy so the butterflies stay in cache
+inline void RingFft::FftColumns(Complex* a, int nx, int ny, int cols, bool inverse) {
+    column.resize(ny);
+    for (int x = 0; x < cols; x++) {
+        for (int y = 0; y < ny; y++) column[y] = a[y*nx + x];
+        Fft(column.data(), ny, inverse);
+        for (int y = 0; y < ny; y++) a[y*nx + x] = column[y];
+    }
+}
+
+// Padding to at least the camera size plus the stencil's reach keeps the circular
+// wrap-around of the FFT out of the camera window.
+inline std::shared_ptr<const RingFft::Kernel> RingFft::KernelFor(const short* ringDx, const short* ringDy, int ringLen,
+                                                                 int reach) {
+    KernelCache& cache = Kernels();
+    {
+        std::lock_guard<std::mutex> lock(cache.m);
+        cache.uses++;
+        for (int i = 0; i < cacheSize; i++) {
+            const Kernel* k = cache.kernels[i].get();
+            if (k && k->Same(ringDx, ringDy, ringLen)) {
+                cache.lastUsed[i] = cache.uses;
+                return cache.kernels[i];
+            }
+        }
+    }
+    // made outside the lock; two detectors wanting the same new one both make it
+    std::shared_ptr<Kernel> k(new Kernel);
+    k->ringDx.assign(ringDx, ringDx + ringLen);
+    k->ringDy.assign(ringDy, ringDy + ringLen);
+    k->nx = PadSize(CAMERA_WIDTH + reach);
+    k->ny = PadSize(CAMERA_HEIGHT + reach);
+    k->spectrum.assign(k->nx*k->ny, Complex(0, 0));
+    for (int i = 0; i < ringLen; i++) {
+        int x = (ringDx[i] + k->nx) % k->nx;
+        int y = (ringDy[i] + k->ny) % k->ny;
+        k->spectrum[y*k->nx + x] += 1.0;
+    }
+    FftRows(k->spectrum.data(), k->nx, k->ny, false);
+    FftColumns(k->spectrum.data(), k->nx, k->ny, k->nx, false);
+
+    std::lock_guard<std::mutex> lock(cache.m);
+    int oldest = 0;
+    for (int i = 1; i < cacheSize; i++) {
+        if (cache.lastUsed[i] < cache.lastUsed[oldest]) oldest = i;
+    }
+    cache.kernels[oldest] = k;
+    cache.lastUsed[oldest] = ++cache.uses;
+    return k;
+}
+
+inline void RingFft::Vote(const short* edgeX, const short* edgeY, int numEdges,
+                          const short* ringDx, const short* ringDy, int ringLen, int reach,
+                          int votes[CAMERA_WIDTH][CAMERA_HEIGHT]) {
+    std::shared_ptr<const Kernel> kernel = KernelFor(ringDx, ringDy, ringLen, reach);
+    const Kernel& k = *kernel;
+    int nx = k.nx;
+    int ny = k.ny;
+    work.assign(nx*ny, Complex(0, 0));
+    for (int i = 0; i < numEdges; i++) work[edgeY[i]*nx + edgeX[i]] = 1.0;
+
+    // rows below the camera are all zero, so only the camera rows need transforming
+    FftRows(work.data(), nx, CAMERA_HEIGHT, false);
+    FftColumns(work.data(), nx, ny, nx, false);
+    for (int i = 0; i < nx*ny; i++) work[i] = Mul(work[i], k.spectrum[i]);
+    FftColumns(work.data(), nx, ny, nx, true);
+    FftRows(work.data(), nx, CAMERA_HEIGHT, true); // and only the camera rows are wanted back
+
+    double scale = 1.0/((double)nx*ny);
+    for (int y = 0; y < CAMERA_HEIGHT; y++) {
+        for (int x = 0; x < CAMERA_WIDTH; x++) {
+            votes[x][y] = (int)lround(work[y*nx + x].real()*scale);
+        }
+    }
+}
+
+#endif
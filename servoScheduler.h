@@ -0,0 +1,135 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Drives the servos from their own thread at a fixed rate. The vision side only sets
+// where each servo should end up; this thread eases the servos there no faster than the
+// slew limit, and only talks to the hardware when a channel's value actually changes.
+// One scheduler drives every head's servos in the process, since hardware_exchange()
+// sends all the motors at once.
+
+#ifndef SERVO_SCHEDULER_H
+#define SERVO_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <thread>
+#include "E101.h"
+#include "histogram.h"
+#include "stats.h"
+
+class ServoScheduler {
+public:
+    static const int maxChannels = 8;
+    int rateHz = 50; // actuation ticks per second
+    double slewRate = 20.0; // servo steps per second, at most
+    int fixBits = 8; // fractional bits of the targets
+
+    // adds a motor starting at this fixed-point target, from one thread at a time (before
+    // or after Start()); returns the channel to give SetTarget(), -1 if there's no room
+    int AddChannel(int motor, int target) {
+        int c = numChannels.load(std::memory_order_relaxed);
+        if (c == maxChannels) return -1;
+        motors[c] = motor;
+        targets[c] = target;
+        current[c] = (double)target/(1 << fixBits);
+        sent[c] = -1;
+        settledAt[c] = target;
+        numChannels.store(c + 1, std::memory_order_release); // the servo thread sees it whole
+        return c;
+    }
+
+    void SetTarget(int channel, int target) {
+        if (targets[channel].exchange(target) != target) settledAt[channel] = INT_MIN; // moving again
+    }
+
+    void Start() {
+        if (running) return;
+        running = true;
+        worker = std::thread(&ServoScheduler::Run, this);
+    }
+
+    void Stop() {
+        running = false;
+        if (worker.joinable()) worker.join();
+    }
+
+    ~ServoScheduler() { Stop(); }
+
+    // hardware exchanges made, and ticks where nothing changed so none was needed
+    long Exchanges() const { return exchanges; }
+    long IdleTicks() const { return idleTicks; }
+
+    // true once every servo, or this channel's, has been eased all the way to its target;
+    // a new target is unsettled from SetTarget() on, before the servo thread has seen it
+    bool Settled() const {
+        int n = numChannels.load(std::memory_order_acquire);
+        for (int c = 0; c < n; c++) {
+            if (!Settled(c)) return false;
+        }
+        return true;
+    }
+    bool Settled(int channel) const { return settledAt[channel] == targets[channel]; }
+
+    // the servo thread, for pinning or rescheduling it once started
+    pthread_t NativeHandle() { return worker.native_handle(); }
+
+    LatencyHistogram lateness; // how late each tick woke up, read once stopped
+
+private:
+    std::atomic<int> numChannels{0};
+    int motors[maxChannels];
+    std::atomic<int> targets[maxChannels]; // fixed-point, written by the vision thread
+    double current[maxChannels]; // where the servo has been eased to so far
+    int sent[maxChannels]; // last value given to set_motors, -1 before the first
+    std::atomic<bool> running{false};
+    std::atomic<long> exchanges{0};
+    std::atomic<long> idleTicks{0};
+    std::atomic<int> settledAt[maxChannels]; // the target each servo last arrived at
+    std::thread worker;
+
+    // eases every channel one tick's worth toward its target
+    void Tick(double maxStep) {
+        TIME_STAGE(STAGE_SERVO_TICK);
+        bool changed = false;
+        int n = numChannels.load(std::memory_order_acquire);
+        for (int c = 0; c < n; c++) {
+            int fixed = targets[c];
+            double target = (double)fixed/(1 << fixBits);
+            double step = target - current[c];
+            // settled for this target only, so one set since it was read isn't
+            if (step <= maxStep && step >= -maxStep) settledAt[c] = fixed;
+            if (step > maxStep) step = maxStep;
+            if (step < -maxStep) step = -maxStep;
+            current[c] += step;
+            int value = (int)lround(current[c]);
+            if (value != sent[c]) {
+                set_motors(motors[c], value);
+                sent[c] = value;
+                changed = true;
+            }
+        }
+        if (changed) {
+            hardware_exchange();
+            exchanges++;
+        } else {
+            idleTicks++;
+        }
+    }
+
+    void Run() {
+        std::chrono::steady_clock::duration period = std::chrono::microseconds(1000000/rateHz);
+        std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+        double maxStep = slewRate/rateHz;
+        while (running) {
+            Tick(maxStep);
+            next += period;
+            std::this_thread::sleep_until(next);
+            std::chrono::steady_clock::duration late = std::chrono::steady_clock::now() - next;
+            lateness.Record(std::chrono::duration_cast<std::chrono::microseconds>(late).count());
+        }
+    }
+};
+
+#endif
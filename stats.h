@@ -0,0 +1,196 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Per-stage timing and counters. Each thread writes its events (a stage's duration, or a
+// count) into its own lock-free ring (ring.h), so the hot path never takes a lock, and
+// the vision loop drains the rings into a latency histogram per stage once a frame.
+// Send the tracker SIGUSR1 to print them, they're printed on exit too.
+// Build with -DNO_STATS and every TIME_STAGE/COUNT_STAT compiles to nothing.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdint>
+#include <mutex>
+#include "histogram.h"
+#include "ring.h"
+
+enum Stage {
+    STAGE_CAPTURE,    // take_picture()
+    STAGE_COPY,       // camera pixels into the frame
+    STAGE_WAIT,       // the tracker waiting for a captured frame
+    STAGE_CONVOLVE,   // Sobel and red mask
+    STAGE_EDGES,      // gap fill and the edge list
+    STAGE_VOTE,       // Hough voting, whichever engine
+    STAGE_PEAKS,      // tally or peak finding
+    STAGE_CHECK,      // checking candidates and refining the centre
+    STAGE_OVERLAY,    // drawing the edges on the screen
+    STAGE_CONTROL,    // PID and handing the pose to the servo thread
+    STAGE_FRAME,      // the whole of FollowSun()
+    STAGE_SERVO_TICK, // one tick of the servo thread
+    NUM_STAGES
+};
+
+enum Counter {
+    COUNT_FRAMES,
+    COUNT_DETECTIONS,
+    COUNT_HALF_CIRCLE, // reject reasons, as Detect() prints them
+    COUNT_OUT_OF_BOUNDS,
+    COUNT_FEW_VOTES,
+    COUNT_NO_RED_LINE,
+    COUNT_SQUARE_CORNER,
+    COUNT_NO_PEAKS,
+    COUNT_EDGES,       // red edge pixels, summed over frames
+    COUNT_VOTE_OPS,    // votes scattered, summed over frames
+    COUNT_OVER_BUDGET, // frames the vote budget thinned
+    NUM_COUNTERS
+};
+
+struct StatEvent {
+    uint16_t id; // stage, or NUM_STAGES + counter
+    uint32_t value; // microseconds, or how much to count
+};
+
+// events a thread can log between collections
+typedef SpscRing<StatEvent, 1024> StatRing;
+
+class Stats {
+public:
+    static const int maxThreads = 64; // heads, pool workers, capture, servo and telemetry threads
+
+    LatencyHistogram stages[NUM_STAGES];
+    long counters[NUM_COUNTERS] = {0};
+
+    static Stats& Global() {
+        static Stats stats;
+        return stats;
+    }
+
+    // from any thread
+    void Time(int stage, uint32_t us) {
+        StatEvent e = {(uint16_t)stage, us};
+        Push(e);
+    }
+    void Count(int counter, uint32_t n) {
+        StatEvent e = {(uint16_t)(NUM_STAGES + counter), n};
+        Push(e);
+    }
+
+    // drains every thread's ring into the histograms; with several heads on a pool every
+    // worker calls it, and whoever finds another already collecting skips it
+    void Collect();
+    void Dump();
+
+    // SIGUSR1 handler, the loop dumps at the end of its frame
+    static void RequestDump(int) { DumpFlag() = 1; }
+    bool DumpRequested() {
+        if (!DumpFlag()) return false;
+        DumpFlag() = 0;
+        return true;
+    }
+
+private:
+    std::atomic<StatRing*> rings[maxThreads] = {};
+    std::atomic<int> numRings{0};
+    std::atomic<long> ringless{0}; // events from threads past maxThreads, which have no ring
+    std::mutex collecting; // the rings have one reader at a time
+
+    static volatile sig_atomic_t& DumpFlag() {
+        static volatile sig_atomic_t flag = 0;
+        return flag;
+    }
+
+    // this thread's ring, made the first time it logs anything; nullptr past maxThreads
+    StatRing* Ring() {
+        thread_local StatRing* ring = nullptr;
+        thread_local bool registered = false;
+        if (registered) return ring;
+        registered = true;
+        int i = numRings.fetch_add(1);
+        if (i >= maxThreads) return nullptr;
+        ring = new StatRing;
+        rings[i].store(ring, std::memory_order_release);
+        return ring;
+    }
+
+    // a ring has only its own thread writing it, so events without one are only counted
+    void Push(const StatEvent& e) {
+        StatRing* ring = Ring();
+        if (ring) ring->Push(e);
+        else ringless.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+inline void Stats::Collect() {
+    std::unique_lock<std::mutex> lock(collecting, std::try_to_lock);
+    if (!lock.owns_lock()) return;
+    int n = numRings.load() < maxThreads ? numRings.load() : maxThreads;
+    for (int i = 0; i < n; i++) {
+        StatRing* ring = rings[i].load(std::memory_order_acquire);
+        if (!ring) continue; // still being registered
+        ring->Drain([this](const StatEvent& e) {
+            if (e.id < NUM_STAGES) stages[e.id].Record(e.value);
+            else counters[e.id - NUM_STAGES] += e.value;
+        });
+    }
+}
+
+inline void Stats::Dump() {
+    static const char* stageNames[NUM_STAGES] = {
+        "capture", "copy", "wait", "convolve", "edges", "vote", "peaks", "check", "overlay", "control", "frame", "servo tick"
+    };
+    static const char* counterNames[NUM_COUNTERS] = {
+        "frames", "detections", "half circle", "out of bounds", "not enough votes", "no middle red line",
+        "square corner", "no peaks", "edge pixels", "vote ops", "over vote budget"
+    };
+    Collect();
+    std::lock_guard<std::mutex> lock(collecting);
+    printf("---- stats ----\n");
+    for (int i = 0; i < NUM_COUNTERS; i++) printf("%s: %ld\n", counterNames[i], counters[i]);
+    long dropped = ringless;
+    int n = numRings.load() < maxThreads ? numRings.load() : maxThreads;
+    for (int i = 0; i < n; i++) {
+        StatRing* ring = rings[i].load(std::memory_order_acquire);
+        if (ring) dropped += ring->dropped;
+    }
+    printf("events dropped: %ld\n", dropped);
+    for (int i = 0; i < NUM_STAGES; i++) {
+        if (stages[i].Count()) stages[i].PrintLine(stageNames[i]);
+    }
+}
+
+// times the rest of the enclosing block as one stage
+class StageTimer {
+public:
+    explicit StageTimer(int stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+    ~StageTimer() {
+        std::chrono::steady_clock::duration d = std::chrono::steady_clock::now() - start;
+        Stats::Global().Time(stage, std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+    }
+
+private:
+    int stage;
+    std::chrono::steady_clock::time_point start;
+};
+
+#ifndef NO_STATS
+#define STAT_JOIN2(a, b) a##b
+#define STAT_JOIN(a, b) STAT_JOIN2(a, b)
+#define TIME_STAGE(stage) StageTimer STAT_JOIN(stageTimer, __LINE__)(stage)
+#define COUNT_STAT(counter, n) Stats::Global().Count(counter, n)
+#define COLLECT_STATS() Stats::Global().Collect()
+#define DUMP_STATS() Stats::Global().Dump()
+#define DUMP_STATS_IF_ASKED() if (Stats::Global().DumpRequested()) Stats::Global().Dump()
+#else
+#define TIME_STAGE(stage)
+#define COUNT_STAT(counter, n)
+#define COLLECT_STATS()
+#define DUMP_STATS()
+#define DUMP_STATS_IF_ASKED()
+#endif
+
+#endif
@@ -0,0 +1,1113 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Sun detection shared by the tracker (main.cpp) and the PC test bench (testImage.cpp).
+// It works on a packed RGB frame of CAMERA_WIDTH*CAMERA_HEIGHT*3 bytes, the same layout
+// testImage reads PPMs into, so tuning on the PC runs exactly what the rig runs.
+
+#ifndef SUN_DETECTOR_H
+#define SUN_DETECTOR_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include "colourTable.h"
+#include "ringFft.h"
+#include "blobs.h"
+#include "peaks.h"
+#include "stats.h"
+#include "logger.h"
+
+#ifndef CAMERA_WIDTH
+#define CAMERA_WIDTH 320 //Control Resolution from Camera
+#define CAMERA_HEIGHT 240 //Control Resolution from Camera
+#endif
+
+const double DEG2RAD = M_PI/180.0;
+#define SUBPIXEL_BITS 8 // fractional bits of the refined centre
+
+// returns color component (color==0 -red,color==1-green,color==2-blue) of a packed frame
+inline int FramePixel(const unsigned char* frame, int row, int col, int color) {
+    return frame[CAMERA_WIDTH*row*3 + col*3 + color];
+}
+
+// how Detect() casts the Hough votes
+enum VoteEngine {
+    VOTE_AUTO,    // whichever of the two is predicted cheaper for this frame
+    VOTE_SCATTER, // a ring of votes from every red edge pixel
+    VOTE_FFT      // edge map convolved with the ring, see ringFft.h
+};
+
+// how Detect() smooths the accumulator before picking peaks, see SmoothTally()
+enum VoteSmoothing {
+    SMOOTH_NONE,
+    SMOOTH_BOX,  // flat weights over 2*smoothRadius+1 cells each way
+    SMOOTH_GAUSS // binomial weights (1 2 1, 1 4 6 4 1), near enough a Gaussian
+};
+
+// where Detect() draws the line between an edge and not, see ThresholdEdges()
+enum EdgeThreshold {
+    EDGE_FIXED,  // convThreshold
+    EDGE_OTSU,   // Otsu's split of the frame's gradient histogram
+    EDGE_DENSITY // whatever leaves edgeDensity of the pixels as edges
+};
+
+#define MAX_GRADIENT 2040 // |sobelX| + |sobelY| on 8 bit pixels
+
+class SunDetector {
+public:
+    // thresholds to play around with:
+    double convThreshold = 65.0;
+    int radiusRange = 0; // 0 sizes it from the radius: 5, or 8 for suns over 50 pixels
+    int degStep = 10;
+    int voteThr = 10;
+
+    // adaptive edges: rather than a fixed convThreshold, take the threshold from a histogram
+    // of the frame's Sobel gradients, built as the Sobel goes, so the number of edges (and
+    // the voting they cost) stays about the same from dawn to noon. The edges are only known
+    // once the last row is in, so streaming only votes then.
+    int edgeThreshold = EDGE_FIXED;
+    double edgeDensity = 0.04; // EDGE_DENSITY: fraction of the pixels that are edges
+    int minEdgeThreshold = 20; // adaptive thresholds go no lower, so a blank sky's noise isn't edges
+
+    // edge thinning: of the red edge pixels, keep only those whose gradient is the strongest
+    // across the edge, as in Canny, so the edges that vote are one pixel wide. The gradient
+    // peaks on the boundary, half a pixel out from the red, so only red pixels' gradients
+    // are compared and the outermost ring of red stays. Other edges are left alone.
+    bool thinEdges = false;
+
+    // radius search: pick the radius from a 3-D (x, y, r) accumulator instead of
+    // 0.51 of the longest horizontal red run, which red clutter on the sun's row blows up
+    bool searchRadius = false;
+    int minRadius = 8;
+    int maxRadius = 110;
+    int radiusSamples = 4; // rings voted per radius bin
+    int radiusNoise = 5; // votes any bin's peak collects from clutter alone
+    int radiusStep = 2; // pixels between the rings tried across the best bin
+
+    int voteEngine = VOTE_AUTO;
+    double fftOpCost = 1.5; // one FFT butterfly costs about this many scattered votes (measured on a PC)
+
+    // blob mode: label the red blobs and vote only inside those shaped like a disc,
+    // each with its own radius, instead of over the whole frame
+    bool useBlobs = false;
+    int minBlobArea = 30; // pixels, smaller specks are ignored
+    double maxBlobAspect = 2.0; // longer side over shorter side of the bounding box
+    double minBlobExtent = 0.55; // blob area over bounding box area, a disc is 0.79
+    double maxBlobExtent = 0.92; // squares fill their box
+
+    // vote budget: when scattering a frame's votes is predicted to take longer than this,
+    // thin the voting until it fits (see Govern()); 0 lets every frame take what it takes
+    double voteBudgetMs = 0;
+    double voteNs = 2.0; // time per scattered vote, re-measured as frames go by
+    int maxDegStep = 30; // coarsest angle step the budget may fall back to
+    double maxArcGap = 16; // and no coarser than leaves this many pixels between a ring's angles
+
+    // candidate centres checked in turn, best first, until one passes as the sun;
+    // 1 keeps only the highest vote like before
+    int peakCandidates = 1;
+
+    // vote smoothing: at a coarse degStep a ring's votes land on scattered cells around
+    // the centre instead of piling up on it, and the single highest cell is noise. A
+    // smoothing pass adds the neighbours back together, so 20-30 degree steps still find
+    // the sun at a fraction of the voting. Not used in blob mode.
+    int smoothing = SMOOTH_NONE;
+    int smoothRadius = 1; // cells either side
+
+    // vote accumulation: carry the votes over from frame to frame, losing 1/2^decayShift of
+    // them each frame, so a sun that stays put builds up while clutter that comes and goes
+    // fades. Each frame can then vote more sparsely: with anglePhases above 1 the angles
+    // start degStep/anglePhases further round every frame, so that many frames between them
+    // cover the ring at degStep/anglePhases. The peaks count as an average frame's votes at
+    // that finer step, so voteThr means the same. Not used in blob mode.
+    int decayShift = 0; // 0 votes every frame afresh
+    int anglePhases = 1;
+
+    // streaming (see Begin()): how many pixels the radius may differ from last frame's
+    // and still keep the votes the rows cast as they came in
+    int streamSlack = 1;
+
+    // the colours that count as "red", the sun's unless another table is loaded
+    ColourTable colours;
+
+    // results of the last Detect()
+    int radius = 0;
+    int maxedX = 0;
+    int maxedY = 0;
+    int maxedVote = 0;
+    int centreX = 0; // maxedX/maxedY refined to 1/(1<<SUBPIXEL_BITS) of a pixel
+    int centreY = 0;
+    int numEdges = 0; // red edge pixels that voted
+    int usedThreshold = 0; // |sobelX| + |sobelY| above this was an edge
+    bool votedWithFft = false;
+    bool degraded = false; // the vote budget thinned this frame's voting
+    char edges[CAMERA_HEIGHT][CAMERA_WIDTH]; // array stores edge detected values
+    uint64_t redMask[CAMERA_HEIGHT][MASK_WORDS]; // one bit per sun coloured pixel
+    int votes[CAMERA_WIDTH][CAMERA_HEIGHT];
+    BlobLabeller labeller;
+    std::vector<Peak> candidates; // centres tried by the last Detect(), best first
+
+    int Detect(const unsigned char* frame);
+
+    // Detect() a row band at a time, for a frame still arriving from the top down: Begin(),
+    // then AddRows() each time more rows are in, then Finish() once they all are. The mask,
+    // Sobel and gap fill keep up with the rows; with stream set the edges also vote as they
+    // are found, on a ring the size of last frame's sun, and Finish() only tallies unless the
+    // sun has changed size by more than streamSlack.
+    void Begin(bool stream);
+    void AddRows(const unsigned char* frame, int rows); // the first rows rows of frame are in
+    int Finish();
+
+    // region of interest: only red edges inside the box vote and only centres inside it
+    // count, so a sun seen there a moment ago is found again without clutter elsewhere winning
+    void SetRoi(int minX, int minY, int maxX, int maxY);
+    void ClearRoi() { SetRoi(0, 0, CAMERA_WIDTH-1, CAMERA_HEIGHT-1); }
+
+    // forgets the votes carried over from past frames, for when the camera has moved
+    void ClearHistory() { historyWeight = 0; }
+
+    // touches every buffer Detect() uses and reserves the lists, so a real-time run takes
+    // its page faults and allocations at startup rather than mid-frame
+    void PreFault();
+
+    // sun coloured pixels, counting every step'th row and column; a cheap look at a frame
+    // before paying for Detect()
+    int RedArea(const unsigned char* frame, int step) const;
+
+    // the thresholds and smoothing as "name value" lines, as written by the tuner
+    // (tuner.cpp); settings a file leaves out keep their values
+    bool SaveSettings(const char* fn) const;
+    bool LoadSettings(const char* fn);
+
+private:
+    short edgeX[CAMERA_WIDTH*CAMERA_HEIGHT];
+    short edgeY[CAMERA_WIDTH*CAMERA_HEIGHT];
+    uint16_t gradient[CAMERA_HEIGHT][CAMERA_WIDTH]; // |sobelX| + |sobelY|, for adaptive edges
+    int gradientHist[MAX_GRADIENT+1];
+    bool thresholded = false; // the adaptive threshold has made the edges
+    double cosTab[360];
+    double sinTab[360];
+    int numAngles = 0;
+    std::vector<short> ringDx; // vote offsets from an edge pixel, one per ring and angle
+    std::vector<short> ringDy;
+    int ringReach = 0;
+    uint16_t slab[CAMERA_HEIGHT][CAMERA_WIDTH]; // one radius bin of the 3-D accumulator
+    int smoothed[CAMERA_WIDTH][CAMERA_HEIGHT]; // votes after the vertical smoothing pass
+    int history[CAMERA_WIDTH][CAMERA_HEIGHT]; // decayed votes of the frames so far
+    double historyWeight = 0; // frames in history, each counted as what's left of it
+    int phase = 0; // of anglePhases, the angle offset this frame votes at
+    RingFft fft;
+    int redRun = 0; // longest horizontal run of red pixels
+    std::vector<short> roiX; // edge pixels inside the blob being voted
+    std::vector<short> roiY;
+    std::vector<short> keptX; // edge pixels the vote budget kept
+    std::vector<short> keptY;
+    double budgetLeftNs = 0;
+    double voteScale = 1; // fraction of the full votes the budget let through
+    bool prevFound = false; // the last frame's sun, which the budget may narrow in on
+    int prevX = 0, prevY = 0, prevRadius = 0;
+    int roiMinX = 0; // region of interest, see SetRoi()
+    int roiMinY = 0;
+    int roiMaxX = CAMERA_WIDTH-1;
+    int roiMaxY = CAMERA_HEIGHT-1;
+    int rowsConvolved = 0; // frame rows with their mask and Sobel done
+    int rowsThinned = 0; // and their edges thinned
+    int rowsCollected = 0; // and gap filled and listed
+    int range = 5; // the ring's spread either side of this frame's radius, from RangeFor()
+    int streamRadius = 0; // radius the rows are voting for as they come, 0 if they wait for Finish()
+    int lastRadius = 0; // last frame's radius from its red run
+
+    PeakFinder peaks;
+
+    bool InRoi(int x, int y) const { return x >= roiMinX && x <= roiMaxX && y >= roiMinY && y <= roiMaxY; }
+    int RangeFor(int r) const { return radiusRange > 0 ? radiusRange : r > 50 ? 8 : 5; }
+
+    bool IsRed(int row, int col) const { return (redMask[row][col >> 6] >> (col & 63)) & 1; }
+    bool IsSquareCorner(int x, int y) const;
+    static void Sobel(const unsigned char* above, int col, int& sobelX, int& sobelY);
+    void ConvolveRow(const unsigned char* frame, int row);
+    int OtsuThreshold() const;
+    int DensityThreshold() const;
+    void ThresholdEdges();
+    int RedGradient(const unsigned char* frame, int row, int col) const;
+    void ThinRow(const unsigned char* frame, int y);
+    void CollectRow(int y);
+    void BuildRing(int lo, int hi, int step);
+    int SearchRadius();
+    int SlabPeak();
+    void Scatter(const short* xs, const short* ys, int n);
+    void Vote(const short* xs, const short* ys, int n);
+    int Govern(const short*& xs, const short*& ys, int n);
+    void Tally(int minX, int minY, int maxX, int maxY, bool probeCorners);
+    int SmoothWeights(int* w) const;
+    void SmoothTally(int minX, int minY, int maxX, int maxY, bool probeCorners);
+    void Accumulate();
+    void VoteBlobs();
+    int Verdict();
+    void RefineCentre();
+};
+
+// Works out once per frame where each ring's votes land relative to the edge pixel,
+// so voting is integer adds only. Offsets a hair under an integer (r*cos(60deg) and
+// friends) snap up to it, as they do once added to a pixel coordinate.
+inline void SunDetector::BuildRing(int lo, int hi, int step) {
+    ringDx.clear();
+    ringDy.clear();
+    ringReach = 0;
+    for (int r = lo; r < hi; r += step) {
+        for (int a = 0; a < numAngles; a++) {
+            int dx = (int) floor(-r*cosTab[a] + 1e-9);
+            int dy = (int) floor(r*sinTab[a] + 1e-9);
+            ringDx.push_back(dx);
+            ringDy.push_back(dy);
+            if (abs(dx) >= ringReach) ringReach = abs(dx) + 1;
+            if (abs(dy) >= ringReach) ringReach = abs(dy) + 1;
+        }
+    }
+}
+
+// Fits scattering n edges into what's left of the frame's vote budget, cheapest loss first:
+// a coarser angle step (the ring is already several pixels thick) while its angles stay
+// within maxArcGap of each other, so a big sun coarsens little, then only the edges near
+// last frame's sun, then every k'th edge. Points xs/ys at the kept edges and returns how
+// many; voteScale says what fraction of the full votes will be cast. With less budget left
+// than one ring, nothing votes and the frame finds no sun.
+inline int SunDetector::Govern(const short*& xs, const short*& ys, int n) {
+    int ringLen = ringDx.size();
+    double allowed = budgetLeftNs/voteNs;
+    if (voteBudgetMs <= 0 || (double)n*ringLen <= allowed) return n;
+    degraded = true;
+    COUNT_STAT(COUNT_OVER_BUDGET, 1);
+    double predictedMs = n*ringLen*voteNs/1e6;
+    if (allowed < ringLen) {
+        LOG_INFO("Vote budget: predicted %.1fms, none left, skipped voting\n", predictedMs);
+        return 0;
+    }
+
+    // every k'th angle of each ring, no further apart along it than maxArcGap
+    double widest = radius > 0 ? maxArcGap/(radius*DEG2RAD) : maxDegStep;
+    int k = 1;
+    while ((double)n*ringLen/k > allowed && degStep*(k+1) <= maxDegStep && degStep*(k+1) <= widest) k++;
+    if (k > 1) {
+        int kept = 0;
+        for (int j = 0; j < ringLen; j++) {
+            if ((j % numAngles) % k != 0) continue;
+            ringDx[kept] = ringDx[j];
+            ringDy[kept] = ringDy[j];
+            kept++;
+        }
+        voteScale *= (double)kept/ringLen;
+        ringLen = kept;
+        ringDx.resize(kept);
+        ringDy.resize(kept);
+    }
+
+    // only the edges around where the sun was
+    bool narrowed = false;
+    if ((double)n*ringLen > allowed && prevFound) {
+        int reach = prevRadius + range + 10;
+        keptX.clear();
+        keptY.clear();
+        for (int i = 0; i < n; i++) {
+            if (abs(xs[i] - prevX) <= reach && abs(ys[i] - prevY) <= reach) {
+                keptX.push_back(xs[i]);
+                keptY.push_back(ys[i]);
+            }
+        }
+        narrowed = (int)keptX.size() < n;
+        n = keptX.size();
+        xs = keptX.data();
+        ys = keptY.data();
+    }
+
+    // every stride'th edge, which always fits as a whole ring does
+    int stride = 1;
+    if ((double)n*ringLen > allowed) stride = (int)ceil(n*ringLen/allowed);
+    if (stride > 1) {
+        if (xs != keptX.data()) {
+            keptX.assign(xs, xs + n);
+            keptY.assign(ys, ys + n);
+        }
+        int kept = 0;
+        for (int i = 0; i < n; i += stride) {
+            keptX[kept] = keptX[i];
+            keptY[kept] = keptY[i];
+            kept++;
+        }
+        voteScale *= n > 0 ? (double)kept/n : 1;
+        n = kept;
+        xs = keptX.data();
+        ys = keptY.data();
+    }
+    const char* near = narrowed ? ", near last sun" : "";
+    if (stride > 1) LOG_INFO("Vote budget: predicted %.1fms, degStep %d%s, 1 in %d edges\n", predictedMs, degStep*k, near, stride);
+    else LOG_INFO("Vote budget: predicted %.1fms, degStep %d%s\n", predictedMs, degStep*k, near);
+    return n;
+}
+
+// adds the ring around each edge pixel to votes
+inline void SunDetector::Scatter(const short* xs, const short* ys, int n) {
+    int ringLen = ringDx.size();
+    for (int i = 0; i < n; i++) {
+        int x = xs[i];
+        int y = ys[i];
+        for (int j = 0; j < ringLen; j++) {
+            int cx = x + ringDx[j];
+            int cy = y + ringDy[j];
+            if (cx >= CAMERA_WIDTH || cx < 0 || cy >= CAMERA_HEIGHT || cy < 0) {
+                continue; // don't look outside camera bounds
+            }
+            votes[cx][cy] += 1;
+        }
+    }
+    COUNT_STAT(COUNT_VOTE_OPS, (double)n*ringLen);
+}
+
+// Scatters the ring around every listed edge pixel into votes, or convolves the edge map
+// with it by FFT when that's predicted to be cheaper.
+inline void SunDetector::Vote(const short* xs, const short* ys, int n) {
+    int ringLen = ringDx.size();
+    double scatterOps = (double)n*ringLen;
+    voteScale = 1;
+    // a ring the FFT hasn't seen (each blob's, each angle phase's) pays for its kernel too
+    votedWithFft = voteEngine == VOTE_FFT;
+    if (voteEngine == VOTE_AUTO) {
+        bool cached = RingFft::Cached(ringDx.data(), ringDy.data(), ringLen);
+        votedWithFft = fftOpCost*RingFft::PredictOps(ringReach, cached) < scatterOps;
+    }
+    if (votedWithFft) {
+        fft.Vote(xs, ys, n, ringDx.data(), ringDy.data(), ringLen, ringReach, votes);
+        return;
+    }
+    n = Govern(xs, ys, n);
+    ringLen = ringDx.size();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Scatter(xs, ys, n);
+    double ops = (double)n*ringLen;
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    budgetLeftNs -= ops*voteNs;
+    if (ops > 20000) voteNs = 0.8*voteNs + 0.2*ns/ops; // small frames time mostly overhead
+}
+
+// Streams the (x, y, r) accumulator one radius bin at a time: each bin votes into the
+// 16-bit slab, its peak is kept and the slab is cleared for the next bin, so the whole
+// cube is never held. Bins widen with the radius (a quarter of it, like radiusRange
+// widens for big suns) and each votes only radiusSamples rings, so the cost grows with
+// log(maxRadius/minRadius) rather than with how big the sun looks.
+inline int SunDetector::SearchRadius() {
+    int bestRadius = radius; // keep the red-run estimate if nothing votes
+    int bestScore = 0;
+    int bestLo = 0;
+    int bestWidth = 0;
+    int width;
+    for (int lo = minRadius; lo < maxRadius; lo += width) {
+        width = lo/4 < 4 ? 4 : lo/4;
+        int stride = width/radiusSamples < 1 ? 1 : width/radiusSamples;
+        BuildRing(lo + stride/2, lo + width, stride);
+        // a ring hits its centre about once per edge pixel every r*degStep pixels of arc,
+        // so (peak - clutter)*r counts the edge pixels behind a circle whatever its size
+        int centre = lo + width/2;
+        int score = (SlabPeak() - radiusNoise)*centre;
+        if (score > bestScore) {
+            bestScore = score;
+            bestRadius = centre;
+            bestLo = lo;
+            bestWidth = width;
+        }
+    }
+    if (bestWidth <= radiusStep) return bestRadius;
+    // the bins are wider than the vote that follows covers, so the winner's middle can be
+    // further off than radiusRange; go through it again a few pixels at a time
+    bestScore = 0;
+    int bandNoise = radiusNoise*radiusStep/radiusSamples;
+    for (int lo = bestLo; lo < bestLo + bestWidth; lo += radiusStep) {
+        BuildRing(lo, lo + radiusStep, 1);
+        int centre = lo + radiusStep/2;
+        int score = (SlabPeak() - bandNoise)*centre;
+        if (score > bestScore) {
+            bestScore = score;
+            bestRadius = centre;
+        }
+    }
+    return bestRadius;
+}
+
+// votes the edges onto the slab with the ring as built, returning the highest cell
+inline int SunDetector::SlabPeak() {
+    memset(slab, 0, sizeof(slab));
+    int ringLen = ringDx.size();
+    for (int i = 0; i < numEdges; i++) {
+        int x = edgeX[i];
+        int y = edgeY[i];
+        for (int j = 0; j < ringLen; j++) {
+            int cx = x + ringDx[j];
+            int cy = y + ringDy[j];
+            if (cx >= CAMERA_WIDTH || cx < 0 || cy >= CAMERA_HEIGHT || cy < 0) {
+                continue; // don't look outside camera bounds
+            }
+            if (slab[cy][cx] != UINT16_MAX) slab[cy][cx]++;
+        }
+    }
+    int peak = 0;
+    for (int y = 0; y < CAMERA_HEIGHT; y++) {
+        for (int x = 0; x < CAMERA_WIDTH; x++) {
+            if (slab[y][x] > peak) peak = slab[y][x];
+        }
+    }
+    return peak;
+}
+
+// Sobel kernels on the blue channel around column col, above pointing at the blue of the
+// row above's first pixel
+inline void SunDetector::Sobel(const unsigned char* above, int col, int& sobelX, int& sobelY) {
+    const unsigned char* middle = above + CAMERA_WIDTH*3;
+    const unsigned char* below = middle + CAMERA_WIDTH*3;
+    int l = col*3 - 3;
+    int c = col*3;
+    int r = col*3 + 3;
+    // vertical edge detect
+    sobelX = -above[l] + above[r] - 2*middle[l] + 2*middle[r] - below[l] + below[r];
+    // horizontal edge detect
+    sobelY = -above[l] - 2*above[c] - above[r] + below[l] + 2*below[c] + below[r];
+}
+
+// Sobel edges on the blue channel, the red mask, and the longest horizontal red run, for
+// one row. The Sobel reads the rows either side, so the row below must have arrived.
+inline void SunDetector::ConvolveRow(const unsigned char* frame, int row) {
+    /* CONVOLUTION */
+    int diamCount = 0;
+    memset(redMask[row], 0, sizeof(redMask[row]));
+    const unsigned char* pixel = frame + CAMERA_WIDTH*row*3;
+    for (int col = 0; col<CAMERA_WIDTH; col++, pixel += 3) {
+        bool isRed = colours.IsTarget(pixel[0], pixel[1], pixel[2]);
+        redMask[row][col >> 6] |= (uint64_t)isRed << (col & 63);
+        // sun diameter detection
+        if (isRed && InRoi(col, row)) {
+            diamCount++;
+        } else {
+            if (diamCount > redRun) redRun=diamCount;
+            diamCount = 0;
+        }
+    }
+    memset(edges[row], 0, sizeof(edges[row]));
+    if (row == 0 || row >= CAMERA_HEIGHT-2) return;
+    // convolve blueness vals using Sobel kernels, in integers so the compiler can vectorize
+    // the loop; |sobelX| + |sobelY| is a whole number, so comparing it with the threshold's
+    // whole part picks the same edges
+    const unsigned char* above = frame + CAMERA_WIDTH*(row-1)*3 + 2;
+    if (edgeThreshold != EDGE_FIXED) {
+        // the gradients wait for ThresholdEdges(), counted while the row is still in cache
+        uint16_t* g = gradient[row];
+        for (int col = 1; col<CAMERA_WIDTH-2; col++) {
+            int sobelX, sobelY;
+            Sobel(above, col, sobelX, sobelY);
+            g[col] = abs(sobelX) + abs(sobelY);
+        }
+        for (int col = 1; col<CAMERA_WIDTH-2; col++) gradientHist[g[col]]++;
+        return;
+    }
+    int threshold = (int)floor(convThreshold);
+    usedThreshold = threshold;
+    char* edge = edges[row];
+    for (int col = 1; col<CAMERA_WIDTH-2; col++) {
+        int sobelX, sobelY;
+        Sobel(above, col, sobelX, sobelY);
+        edge[col] = abs(sobelX) + abs(sobelY) > threshold;
+    }
+}
+
+// Otsu's method: the threshold that splits the gradients into two classes with the most
+// variance between them, which for a frame is the flat background and the edges
+inline int SunDetector::OtsuThreshold() const {
+    double count = 0;
+    double sum = 0;
+    for (int g = 0; g <= MAX_GRADIENT; g++) {
+        count += gradientHist[g];
+        sum += (double)g*gradientHist[g];
+    }
+    double below = 0; // pixels at or under the threshold
+    double belowSum = 0;
+    double best = -1;
+    int threshold = 0;
+    for (int g = 0; g < MAX_GRADIENT; g++) {
+        below += gradientHist[g];
+        belowSum += (double)g*gradientHist[g];
+        double above = count - below;
+        if (below == 0) continue;
+        if (above == 0) break;
+        double diff = belowSum/below - (sum - belowSum)/above;
+        double between = below*above*diff*diff;
+        if (between > best) {
+            best = between;
+            threshold = g;
+        }
+    }
+    return threshold;
+}
+
+// the lowest threshold that leaves no more than edgeDensity of the pixels above it
+inline int SunDetector::DensityThreshold() const {
+    double allowed = edgeDensity*(CAMERA_WIDTH-3)*(CAMERA_HEIGHT-3);
+    double over = 0; // pixels above g
+    for (int g = MAX_GRADIENT; g > 0; g--) {
+        over += gradientHist[g];
+        if (over > allowed) return g;
+    }
+    return 0;
+}
+
+// The edges once every row's gradients are counted, for the adaptive thresholds.
+inline void SunDetector::ThresholdEdges() {
+    int threshold = edgeThreshold == EDGE_OTSU ? OtsuThreshold() : DensityThreshold();
+    if (threshold < minEdgeThreshold) threshold = minEdgeThreshold;
+    usedThreshold = threshold;
+    LOG_DEBUG("edge threshold: %d\n", threshold);
+    for (int row = 1; row < CAMERA_HEIGHT-2; row++) {
+        const uint16_t* g = gradient[row];
+        char* edge = edges[row];
+        for (int col = 1; col<CAMERA_WIDTH-2; col++) edge[col] = g[col] > threshold;
+    }
+    thresholded = true;
+}
+
+// |sobelX| + |sobelY| at a red pixel, 0 elsewhere or where there's no Sobel
+inline int SunDetector::RedGradient(const unsigned char* frame, int row, int col) const {
+    if (row == 0 || row >= CAMERA_HEIGHT-2 || col == 0 || col >= CAMERA_WIDTH-2 || !IsRed(row, col)) return 0;
+    int sobelX, sobelY;
+    Sobel(frame + CAMERA_WIDTH*(row-1)*3 + 2, col, sobelX, sobelY);
+    return abs(sobelX) + abs(sobelY);
+}
+
+// Canny's non-maximum suppression for one row: a red edge pixel stays only if its gradient
+// is at least that of the red pixels either side of it across the edge, and more than the
+// one ahead, so a flat top keeps one pixel. Red edges are only a few pixels in a hundred,
+// so the row is walked a red mask word at a time and the gradients are worked out as
+// needed rather than kept for every pixel. The row below must have been through the Sobel.
+inline void SunDetector::ThinRow(const unsigned char* frame, int y) {
+    if (y == 0 || y >= CAMERA_HEIGHT-2) return; // no edges there
+    const unsigned char* above = frame + CAMERA_WIDTH*(y-1)*3 + 2;
+    for (int w = 0; w < MASK_WORDS; w++) {
+        for (uint64_t bits = redMask[y][w]; bits; bits &= bits-1) {
+            int x = w*64 + __builtin_ctzll(bits);
+            if (edges[y][x] == 0) continue;
+            int sobelX, sobelY;
+            Sobel(above, x, sobelX, sobelY);
+            int ax = abs(sobelX);
+            int ay = abs(sobelY);
+            // a step across the edge: along x, along y, or diagonal; tan(22.5deg) is about 106/256
+            int dx = 256*ax > 106*ay ? (sobelX < 0 ? -1 : 1) : 0;
+            int dy = 256*ay > 106*ax ? (sobelY < 0 ? -1 : 1) : 0;
+            int g = ax + ay;
+            if (g < RedGradient(frame, y-dy, x-dx) || g <= RedGradient(frame, y+dy, x+dx)) edges[y][x] = 0;
+        }
+    }
+}
+
+// Fills one row's edge gaps and lists its red edge pixels, which will vote. The gaps are
+// filled from the row above (already filled) and the row below (not yet), so the row
+// below's edges must be in.
+inline void SunDetector::CollectRow(int y) {
+    for (int x=0; x<CAMERA_WIDTH; x++) {
+        // fill in gaps where we're confident there's an edge
+        if (y>0 && y<CAMERA_HEIGHT-1 && edges[y-1][x] == 1 && edges[y+1][x] == 1) edges[y][x] = 1;
+        if (x>0 && x<CAMERA_WIDTH-1 && edges[y][x-1] == 1 && edges[y][x+1] == 1) edges[y][x] = 1;
+    }
+    for (int x=0; x<CAMERA_WIDTH; x++) { // only red edge pixels vote
+        if (edges[y][x] == 1 && IsRed(y, x) && InRoi(x, y)) {
+            edgeX[numEdges] = x;
+            edgeY[numEdges] = y;
+            numEdges++;
+        }
+    }
+}
+
+// true if there's a red edge where a square's top left and bottom right corners would be
+// for a circle of this radius centred at (x, y)
+inline bool SunDetector::IsSquareCorner(int x, int y) const {
+    bool isLeftCorner = false;
+    bool isRightCorner = false;
+
+    int squareX = x-radius+3; // ignore shapes with a top left square corner
+    int squareY = y-radius+3;
+    if (squareX > 0 && squareY > 0) {
+        if (IsRed(squareY, squareX) && edges[squareY][squareX] == 1) isLeftCorner = true;
+    }
+
+    squareX = x+radius-3; // move to bottom right corner
+    squareY = y+radius-3;
+    if (squareX >= 0 && squareY >= 0 && squareX < 240 && squareY < 240) {
+        if (IsRed(squareY, squareX) && edges[squareY][squareX] == 1) isRightCorner = true;
+    }
+    return isLeftCorner && isRightCorner;
+}
+
+// Keeps the highest vote inside the box as the centre. probeCorners skips centres that
+// look like the corner of a square.
+inline void SunDetector::Tally(int minX, int minY, int maxX, int maxY, bool probeCorners) {
+    /* TALLY THE VOTES */
+    maxedX = 0;
+    maxedY = 0;
+    maxedVote = 0;
+    for (int y=minY; y<=maxY; y++) {
+        for (int x = minX; x <= maxX; x++) {
+            if (probeCorners && IsSquareCorner(x, y)) continue;
+
+            if (votes[x][y] > maxedVote) {
+                maxedVote = votes[x][y];
+                maxedX = x;
+                maxedY = y;
+            }
+        }
+    }
+}
+
+// Fills w[0..2*smoothRadius] with the smoothing weights, returns what they add up to.
+inline int SunDetector::SmoothWeights(int* w) const {
+    int n = 2*smoothRadius + 1;
+    int total = 0;
+    for (int i = 0; i < n; i++) {
+        w[i] = 1;
+        if (smoothing == SMOOTH_GAUSS) {
+            for (int j = 0; j < i; j++) w[i] = w[i]*(n-1-j)/(j+1); // n-1 choose i
+        }
+        total += w[i];
+    }
+    return total;
+}
+
+// Smooths votes in place with the separable kernel, down the columns into smoothed and
+// then across them back into votes, and keeps the highest smoothed cell inside the box
+// like Tally() on the way, so the accumulator is only read twice. Each pass is a plain
+// loop down a column, which the compiler vectorizes; the corner probe only runs on the
+// few columns whose top beats the best so far. Votes stay weighted sums, Finish() scales
+// the peaks back by what the weights add up to.
+inline void SunDetector::SmoothTally(int minX, int minY, int maxX, int maxY, bool probeCorners) {
+    int w[2*8+1];
+    if (smoothRadius > 8) smoothRadius = 8;
+    SmoothWeights(w);
+    int r = smoothRadius;
+    for (int x = 0; x < CAMERA_WIDTH; x++) {
+        int* out = smoothed[x];
+        const int* in = votes[x];
+        for (int y = 0; y < CAMERA_HEIGHT; y++) out[y] = 0;
+        for (int d = -r; d <= r; d++) {
+            int wd = w[d+r];
+            int lo = d < 0 ? -d : 0;
+            int hi = d > 0 ? CAMERA_HEIGHT-d : CAMERA_HEIGHT;
+            for (int y = lo; y < hi; y++) out[y] += wd*in[y+d];
+        }
+    }
+    maxedX = 0;
+    maxedY = 0;
+    maxedVote = 0;
+    for (int x = 0; x < CAMERA_WIDTH; x++) {
+        int* out = votes[x];
+        for (int y = 0; y < CAMERA_HEIGHT; y++) out[y] = 0;
+        for (int d = -r; d <= r; d++) {
+            if (x+d < 0 || x+d >= CAMERA_WIDTH) continue;
+            int wd = w[d+r];
+            const int* in = smoothed[x+d];
+            for (int y = 0; y < CAMERA_HEIGHT; y++) out[y] += wd*in[y];
+        }
+        if (x < minX || x > maxX) continue;
+        int top = 0;
+        for (int y = minY; y <= maxY; y++) top = out[y] > top ? out[y] : top;
+        if (top <= maxedVote) continue;
+        for (int y = minY; y <= maxY; y++) {
+            if (out[y] <= maxedVote) continue;
+            if (probeCorners && IsSquareCorner(x, y)) continue;
+            maxedVote = out[y];
+            maxedX = x;
+            maxedY = y;
+        }
+    }
+}
+
+// Decays history by 1/2^decayShift, rounding up so it drains to zero, adds this frame's
+// votes and leaves the total in votes for the tally. Like the smoothing, it's a plain
+// loop down each column that the compiler vectorizes into shifts and adds.
+inline void SunDetector::Accumulate() {
+    int shift = decayShift < 16 ? decayShift : 16;
+    int round = (1 << shift) - 1;
+    bool fresh = historyWeight == 0;
+    for (int x = 0; x < CAMERA_WIDTH; x++) {
+        int* h = history[x];
+        int* v = votes[x];
+        if (fresh) {
+            for (int y = 0; y < CAMERA_HEIGHT; y++) h[y] = v[y];
+        } else {
+            for (int y = 0; y < CAMERA_HEIGHT; y++) {
+                h[y] += v[y] - ((h[y] + round) >> shift);
+                v[y] = h[y];
+            }
+        }
+    }
+    historyWeight = historyWeight*(1 - 1.0/(1 << shift)) + 1;
+}
+
+// Votes each red blob shaped like a disc on its own, with a radius from its bounding box,
+// and lists the blobs' centres as candidates, those with the most edge pixels behind them
+// (votes*radius, as in SearchRadius) first so a small round Mars loses to a bigger sun.
+inline void SunDetector::VoteBlobs() {
+    labeller.Label(redMask, minBlobArea);
+    int round = 0;
+    for (const Blob& b : labeller.blobs) {
+        int w = b.maxX - b.minX + 1;
+        int h = b.maxY - b.minY + 1;
+        double aspect = w > h ? (double)w/h : (double)h/w;
+        if (aspect > maxBlobAspect || b.extent < minBlobExtent || b.extent > maxBlobExtent) continue;
+        if (!InRoi((int)b.centroidX, (int)b.centroidY)) continue;
+        round++;
+
+        // a disc cut off by the frame edge still shows its full width or height
+        radius = (w > h ? w : h)/2;
+        range = RangeFor(radius);
+        roiX.clear();
+        roiY.clear();
+        for (int i = 0; i < numEdges; i++) {
+            if (edgeX[i] >= b.minX-2 && edgeX[i] <= b.maxX+2 && edgeY[i] >= b.minY-2 && edgeY[i] <= b.maxY+2) {
+                roiX.push_back(edgeX[i]);
+                roiY.push_back(edgeY[i]);
+            }
+        }
+        for (int x = b.minX; x <= b.maxX; x++) { // other blobs may have voted in here
+            for (int y = b.minY; y <= b.maxY; y++) votes[x][y] = 0;
+        }
+        BuildRing(radius-range, radius+range, 1);
+        Vote(roiX.data(), roiY.data(), roiX.size());
+        Tally(b.minX, b.minY, b.maxX, b.maxY, false);
+        Peak p = {maxedX, maxedY, (int)lround(maxedVote/voteScale), radius};
+        candidates.push_back(p);
+    }
+    LOG_DEBUG("blobs: %d round: %d\n", (int)labeller.blobs.size(), round);
+    std::sort(candidates.begin(), candidates.end(), [](const Peak& a, const Peak& b) {
+        return a.votes*a.radius > b.votes*b.radius;
+    });
+    if ((int)candidates.size() > peakCandidates) candidates.resize(peakCandidates);
+}
+
+// Checks the vote-maximised centre really is a whole sun.
+inline int SunDetector::Verdict() {
+    // count how many red pixels in middle
+    int diamCount = 0;
+    double diameter = 0;
+    for (int r=0; r<CAMERA_HEIGHT; r++) {
+        if (IsRed(r, maxedX)) {
+            diamCount++;
+        } else {
+            if (diamCount > diameter) diameter=diamCount;
+            diamCount = 0;
+        }
+    }
+
+    if (edges[maxedY][maxedX] == 1) {
+        LOG_DEBUG("Half circle\n");
+        COUNT_STAT(COUNT_HALF_CIRCLE, 1);
+        return 0;
+    } else if (maxedY>CAMERA_HEIGHT-radius/2 || maxedY<radius/2) {
+        LOG_DEBUG("Out of bounds\n");
+        COUNT_STAT(COUNT_OUT_OF_BOUNDS, 1);
+        return 0;
+    } else if (maxedVote<voteThr) {
+        LOG_DEBUG("Not enough votes\n");
+        COUNT_STAT(COUNT_FEW_VOTES, 1);
+        return 0;
+    } else if (abs(diameter/2-radius) > 5) {
+        LOG_DEBUG("No middle red line\n");
+        COUNT_STAT(COUNT_NO_RED_LINE, 1);
+        return 0;
+    }
+    return 1;
+}
+
+// where the top of a parabola through three evenly spaced samples lies, relative to the middle one
+inline double ParabolaPeak(double a, double b, double c) {
+    double curve = a - 2*b + c;
+    if (curve >= 0) return 0; // flat or not a peak
+    double offset = 0.5*(a - c)/curve;
+    if (offset > 0.5) offset = 0.5;
+    if (offset < -0.5) offset = -0.5;
+    return offset;
+}
+
+// Quadratic fit over the 3x3 votes around maxedX/maxedY: a parabola through the column
+// sums gives x and one through the row sums gives y, to a fraction of a pixel.
+inline void SunDetector::RefineCentre() {
+    double dx = 0;
+    double dy = 0;
+    if (maxedX > 0 && maxedX < CAMERA_WIDTH-1 && maxedY > 0 && maxedY < CAMERA_HEIGHT-1) {
+        double col[3] = {0, 0, 0};
+        double row[3] = {0, 0, 0};
+        for (int i = -1; i <= 1; i++) {
+            for (int j = -1; j <= 1; j++) {
+                col[i+1] += votes[maxedX+i][maxedY+j];
+                row[j+1] += votes[maxedX+i][maxedY+j];
+            }
+        }
+        dx = ParabolaPeak(col[0], col[1], col[2]);
+        dy = ParabolaPeak(row[0], row[1], row[2]);
+    }
+    centreX = (int)lround((maxedX + dx)*(1 << SUBPIXEL_BITS));
+    centreY = (int)lround((maxedY + dy)*(1 << SUBPIXEL_BITS));
+}
+
+inline void SunDetector::SetRoi(int minX, int minY, int maxX, int maxY) {
+    roiMinX = minX > 0 ? minX : 0;
+    roiMinY = minY > 0 ? minY : 0;
+    roiMaxX = maxX < CAMERA_WIDTH-1 ? maxX : CAMERA_WIDTH-1;
+    roiMaxY = maxY < CAMERA_HEIGHT-1 ? maxY : CAMERA_HEIGHT-1;
+}
+
+inline void SunDetector::PreFault() {
+    memset(edges, 0, sizeof(edges));
+    memset(redMask, 0, sizeof(redMask));
+    memset(votes, 0, sizeof(votes));
+    memset(edgeX, 0, sizeof(edgeX));
+    memset(edgeY, 0, sizeof(edgeY));
+    memset(gradient, 0, sizeof(gradient));
+    memset(slab, 0, sizeof(slab));
+    memset(history, 0, sizeof(history));
+    int ringMax = 2*RangeFor(CAMERA_WIDTH)*360; // the widest ring either side at 1 degree steps
+    ringDx.reserve(ringMax);
+    ringDy.reserve(ringMax);
+    roiX.reserve(CAMERA_WIDTH*CAMERA_HEIGHT);
+    roiY.reserve(CAMERA_WIDTH*CAMERA_HEIGHT);
+    keptX.reserve(CAMERA_WIDTH*CAMERA_HEIGHT);
+    keptY.reserve(CAMERA_WIDTH*CAMERA_HEIGHT);
+    candidates.reserve(64);
+}
+
+inline int SunDetector::RedArea(const unsigned char* frame, int step) const {
+    int count = 0;
+    for (int row = step/2; row < CAMERA_HEIGHT; row += step) {
+        for (int col = step/2; col < CAMERA_WIDTH; col += step) {
+            const unsigned char* pixel = frame + CAMERA_WIDTH*row*3 + col*3;
+            if (colours.IsTarget(pixel[0], pixel[1], pixel[2])) count++;
+        }
+    }
+    return count*step*step;
+}
+
+inline bool SunDetector::SaveSettings(const char* fn) const {
+    FILE* fp = fopen(fn, "w");
+    if (!fp) {
+        printf("Unable to open the file\n");
+        return false;
+    }
+    fprintf(fp, "# DreamTrack detector settings\n");
+    fprintf(fp, "convThreshold %g\n", convThreshold);
+    fprintf(fp, "edgeThreshold %d\n", edgeThreshold);
+    fprintf(fp, "edgeDensity %g\n", edgeDensity);
+    fprintf(fp, "radiusRange %d\n", radiusRange);
+    fprintf(fp, "degStep %d\n", degStep);
+    fprintf(fp, "voteThr %d\n", voteThr);
+    fprintf(fp, "smoothing %d\n", smoothing);
+    fprintf(fp, "smoothRadius %d\n", smoothRadius);
+    fclose(fp);
+    return true;
+}
+
+inline bool SunDetector::LoadSettings(const char* fn) {
+    FILE* fp = fopen(fn, "r");
+    if (!fp) return false;
+    char line[128];
+    while (fgets(line, sizeof(line), fp)) {
+        char name[64];
+        double value;
+        if (line[0] == '#' || sscanf(line, "%63s %lf", name, &value) != 2) continue;
+        if (strcmp(name, "convThreshold") == 0) convThreshold = value;
+        else if (strcmp(name, "edgeThreshold") == 0) edgeThreshold = (int)value;
+        else if (strcmp(name, "edgeDensity") == 0) edgeDensity = value;
+        else if (strcmp(name, "radiusRange") == 0) radiusRange = (int)value;
+        else if (strcmp(name, "degStep") == 0) degStep = (int)value;
+        else if (strcmp(name, "voteThr") == 0) voteThr = (int)value;
+        else if (strcmp(name, "smoothing") == 0) smoothing = (int)value;
+        else if (strcmp(name, "smoothRadius") == 0) smoothRadius = (int)value;
+        else printf("Unknown setting '%s' in %s\n", name, fn);
+    }
+    fclose(fp);
+    return true;
+}
+
+inline void SunDetector::Begin(bool stream) {
+    rowsConvolved = 0;
+    rowsThinned = 0;
+    rowsCollected = 0;
+    numEdges = 0;
+    thresholded = false;
+    if (edgeThreshold != EDGE_FIXED) memset(gradientHist, 0, sizeof(gradientHist));
+    redRun = 0;
+    memset(votes, 0, sizeof(votes));
+    // accumulating, each frame starts the angles a little further round than the last
+    int offset = 0;
+    if (decayShift > 0 && anglePhases > 1) {
+        phase = (phase + 1) % anglePhases;
+        offset = phase*degStep/anglePhases;
+    }
+    numAngles = 0;
+    for (int deg=offset; deg<360+offset; deg+=degStep) {
+        cosTab[numAngles] = cos(deg*DEG2RAD);
+        sinTab[numAngles] = sin(deg*DEG2RAD);
+        numAngles++;
+    }
+    // only a plain scatter of the whole frame can start before the radius is known
+    streamRadius = 0;
+    if (stream && lastRadius > 0 && !useBlobs && !searchRadius && voteEngine != VOTE_FFT && voteBudgetMs <= 0) {
+        streamRadius = lastRadius;
+        range = RangeFor(streamRadius);
+        BuildRing(streamRadius-range, streamRadius+range, 1);
+    }
+}
+
+inline void SunDetector::AddRows(const unsigned char* frame, int rows) {
+    {
+        TIME_STAGE(STAGE_CONVOLVE);
+        int ready = rows == CAMERA_HEIGHT ? CAMERA_HEIGHT : rows-1;
+        for (; rowsConvolved < ready; rowsConvolved++) ConvolveRow(frame, rowsConvolved);
+        if (edgeThreshold != EDGE_FIXED && rowsConvolved == CAMERA_HEIGHT && !thresholded) ThresholdEdges();
+    }
+    int first = numEdges;
+    {
+        TIME_STAGE(STAGE_EDGES);
+        // each step needs the row below to have been through the one before, and adaptive
+        // edges are only there once the whole frame is
+        int convolved = edgeThreshold == EDGE_FIXED || thresholded ? rowsConvolved : 0;
+        int ready = convolved == CAMERA_HEIGHT ? CAMERA_HEIGHT : convolved-1;
+        if (!thinEdges) rowsThinned = convolved;
+        for (; rowsThinned < ready; rowsThinned++) ThinRow(frame, rowsThinned);
+        ready = rowsThinned == CAMERA_HEIGHT ? CAMERA_HEIGHT : rowsThinned-1;
+        for (; rowsCollected < ready; rowsCollected++) CollectRow(rowsCollected);
+    }
+    if (streamRadius) {
+        TIME_STAGE(STAGE_VOTE);
+        Scatter(edgeX + first, edgeY + first, numEdges - first);
+    }
+}
+
+// Runs the convolution, Hough voting and tally over one frame.
+// Returns 1 if one of the candidate centres looks like the sun, 0 otherwise.
+inline int SunDetector::Detect(const unsigned char* frame) {
+    Begin(false);
+    AddRows(frame, CAMERA_HEIGHT);
+    return Finish();
+}
+
+// The tally and checks once every row is in, and the voting too unless the rows did it.
+inline int SunDetector::Finish() {
+    COUNT_STAT(COUNT_EDGES, numEdges);
+    candidates.clear();
+    degraded = false;
+    budgetLeftNs = voteBudgetMs*1e6;
+    maxedX = 0;
+    maxedY = 0;
+    maxedVote = 0;
+    if (useBlobs) {
+        {
+            TIME_STAGE(STAGE_VOTE);
+            VoteBlobs();
+        }
+        if (candidates.empty()) {
+            LOG_DEBUG("No round red blobs\n");
+            COUNT_STAT(COUNT_NO_PEAKS, 1);
+            prevFound = false;
+            RefineCentre();
+            return 0;
+        }
+        LOG_DEBUG("radius: %d\n",candidates[0].radius);
+    } else {
+        TIME_STAGE(STAGE_VOTE);
+        radius = redRun*0.51;
+        lastRadius = radius;
+        if (searchRadius) radius = SearchRadius();
+        bool voted = streamRadius && abs(radius - streamRadius) <= streamSlack;
+        if (voted) radius = streamRadius; // the rows have voted for this one already
+        else if (streamRadius) memset(votes, 0, sizeof(votes)); // cast for the wrong size, start over
+        range = RangeFor(radius);
+        LOG_DEBUG("radius: %d\n",radius);
+
+        if (voted) {
+            voteScale = 1;
+            votedWithFft = false;
+        } else {
+            BuildRing(radius-range, radius+range, 1);
+            Vote(edgeX, edgeY, numEdges);
+        }
+    }
+    if (!useBlobs) {
+        TIME_STAGE(STAGE_PEAKS);
+        int minX = roiMinX > 1 ? roiMinX : 1;
+        int minY = roiMinY > 1 ? roiMinY : 1;
+        int maxX = roiMaxX < CAMERA_WIDTH-2 ? roiMaxX : CAMERA_WIDTH-2;
+        int maxY = roiMaxY < CAMERA_HEIGHT-2 ? roiMaxY : CAMERA_HEIGHT-2;
+        if (decayShift > 0) Accumulate();
+        if (smoothing != SMOOTH_NONE) SmoothTally(minX, minY, maxX, maxY, peakCandidates == 1);
+        if (peakCandidates > 1) {
+            int spacing = radius/2 > 3 ? radius/2 : 3;
+            peaks.Find(votes, roiMinX, roiMinY, roiMaxX, roiMaxY, peakCandidates, spacing, radius, candidates);
+        } else {
+            if (smoothing == SMOOTH_NONE) Tally(minX, minY, maxX, maxY, true);
+            Peak p = {maxedX, maxedY, maxedVote, radius};
+            candidates.push_back(p);
+        }
+        // smoothed peaks are weighted sums over their neighbours; their weighted average is in
+        // the same units as a single cell's votes, so voteThr means the same
+        if (smoothing != SMOOTH_NONE) {
+            int w[2*8+1];
+            double total = SmoothWeights(w);
+            for (Peak& p : candidates) p.votes = lround(p.votes/(total*total));
+        }
+        // an average frame's votes over all anglePhases offsets
+        if (decayShift > 0) {
+            double frames = historyWeight/(anglePhases > 1 ? anglePhases : 1);
+            for (Peak& p : candidates) p.votes = lround(p.votes/frames);
+        }
+        // votes as if the budget hadn't thinned them, so voteThr means the same
+        if (voteScale < 1) {
+            for (Peak& p : candidates) p.votes = lround(p.votes/voteScale);
+        }
+    }
+
+    if (candidates.empty()) {
+        LOG_DEBUG("No peaks\n");
+        COUNT_STAT(COUNT_NO_PEAKS, 1);
+        prevFound = false;
+        RefineCentre();
+        return 0;
+    }
+    TIME_STAGE(STAGE_CHECK);
+    // the first candidate that passes every check is the sun
+    for (const Peak& p : candidates) {
+        maxedX = p.x;
+        maxedY = p.y;
+        maxedVote = p.votes;
+        radius = p.radius;
+        LOG_DEBUG("x: %d y: %d votes: %d\n", maxedX, maxedY, maxedVote);
+        if (peakCandidates > 1 && !useBlobs && IsSquareCorner(maxedX, maxedY)) {
+            LOG_DEBUG("Square corner\n");
+            COUNT_STAT(COUNT_SQUARE_CORNER, 1);
+            continue;
+        }
+        if (Verdict()) {
+            RefineCentre();
+            prevFound = true;
+            prevX = maxedX;
+            prevY = maxedY;
+            prevRadius = radius;
+            return 1;
+        }
+    }
+    prevFound = false;
+    // none did, report the best
+    maxedX = candidates[0].x;
+    maxedY = candidates[0].y;
+    maxedVote = candidates[0].votes;
+    radius = candidates[0].radius;
+    RefineCentre();
+    return 0;
+}
+
+#endif
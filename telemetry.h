@@ -0,0 +1,195 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Per-frame telemetry over the E101 networking functions, so a rig can be watched from a
+// PC without a screen attached (telemetryServer.cpp is the PC end). Each frame's result is
+// packed into one of E101's 24-byte messages. The vision loop only puts the record in a
+// ring (ring.h); a background thread connects, and every batchMs sends whatever has queued.
+// When the ring is full or the server is away, records are dropped and counted.
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "E101.h"
+#include "ring.h"
+
+#define TELEMETRY_SIZE 24 // E101 messages are always this long
+
+// one frame's result; sizes are what fits the message
+struct TelemetryRecord {
+    uint16_t seq;        // counts frames, so the server can tell what was dropped
+    uint32_t dtUs;       // microseconds since the last record
+    int32_t centreX;     // sub-pixel centre, 1/(1<<SUBPIXEL_BITS) of a pixel
+    int32_t centreY;
+    uint16_t radius;
+    uint16_t votes;
+    uint16_t azimuth;    // servo pose, fixed point (FIX_BITS)
+    uint16_t elevation;
+    uint8_t found;       // the verdict
+    uint8_t state;       // TrackState
+};
+
+// little-endian whatever the machine, so the server needn't be a Pi
+inline void PackTelemetry(const TelemetryRecord& r, char out[TELEMETRY_SIZE]) {
+    unsigned char* p = (unsigned char*)out;
+    uint32_t words[4] = {r.dtUs, (uint32_t)r.centreX, (uint32_t)r.centreY,
+                         (uint32_t)r.radius | (uint32_t)r.votes << 16};
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 4; b++) *p++ = words[i] >> (8*b);
+    }
+    uint16_t halves[3] = {r.azimuth, r.elevation, r.seq};
+    for (int i = 0; i < 3; i++) {
+        *p++ = halves[i];
+        *p++ = halves[i] >> 8;
+    }
+    *p++ = r.found;
+    *p++ = r.state;
+}
+
+inline void UnpackTelemetry(const char in[TELEMETRY_SIZE], TelemetryRecord& r) {
+    const unsigned char* p = (const unsigned char*)in;
+    uint32_t words[4];
+    for (int i = 0; i < 4; i++) {
+        words[i] = 0;
+        for (int b = 0; b < 4; b++) words[i] |= (uint32_t)*p++ << (8*b);
+    }
+    uint16_t halves[3];
+    for (int i = 0; i < 3; i++) {
+        halves[i] = p[0] | p[1] << 8;
+        p += 2;
+    }
+    r.dtUs = words[0];
+    r.centreX = (int32_t)words[1];
+    r.centreY = (int32_t)words[2];
+    r.radius = words[3] & 0xffff;
+    r.votes = words[3] >> 16;
+    r.azimuth = halves[0];
+    r.elevation = halves[1];
+    r.seq = halves[2];
+    r.found = *p++;
+    r.state = *p++;
+}
+
+class Telemetry {
+public:
+    int batchMs = 100; // how often queued records are sent
+    int retryMs = 2000; // wait before connecting again after a failure
+
+    // connects to the server on the background thread and starts sending
+    void Start(const char* address, int port);
+    void Stop();
+    ~Telemetry() { Stop(); }
+
+    // from the vision loop only; fills in seq and dtUs, never waits
+    void Publish(TelemetryRecord r);
+
+    long Sent() const { return channel ? (long)channel->sent : 0; }
+    long Dropped() const { return channel ? channel->records.dropped + channel->unsent : 0; }
+
+private:
+    // everything the background thread touches. The thread holds its own reference, so a
+    // thread left stuck in connect_to_server() by Stop() never reads a Telemetry that's gone.
+    struct Channel {
+        SpscRing<TelemetryRecord, 256> records;
+        char address[16]; // the longest dotted quad and its terminator
+        int port = 0;
+        int batchMs = 0;
+        int retryMs = 0;
+        std::atomic<bool> running{false};
+        std::atomic<long> sent{0};
+        std::atomic<long> unsent{0}; // drained while there was no server
+        std::mutex m; // Stop() and the thread agree under it on whether it's in connect_to_server()
+        bool connecting = false;
+    };
+    std::shared_ptr<Channel> channel;
+    std::thread worker;
+    uint16_t seq = 0;
+    std::chrono::steady_clock::time_point last;
+
+    static void Run(std::shared_ptr<Channel> c);
+};
+
+inline void Telemetry::Start(const char* addr, int p) {
+    if (channel && channel->running) return;
+    channel = std::make_shared<Channel>(); // a thread left behind keeps the old one
+    // connect_to_server() takes up to 15 chars, the longest dotted quad
+    size_t len = strlen(addr) < sizeof(channel->address)-1 ? strlen(addr) : sizeof(channel->address)-1;
+    memcpy(channel->address, addr, len);
+    channel->address[len] = '\0';
+    channel->port = p;
+    channel->batchMs = batchMs;
+    channel->retryMs = retryMs;
+    last = std::chrono::steady_clock::now();
+    channel->running = true;
+    worker = std::thread(&Telemetry::Run, channel);
+}
+
+inline void Telemetry::Stop() {
+    if (!channel || !channel->running) return;
+    bool connecting;
+    {
+        std::lock_guard<std::mutex> lock(channel->m);
+        channel->running = false;
+        connecting = channel->connecting;
+    }
+    // connect_to_server() can take minutes to give up on a server that's not there, so a
+    // thread still stuck in it is left behind, with the channel, rather than holding up the exit.
+    // One that isn't won't start connecting now it's seen running go false.
+    if (connecting) worker.detach();
+    else if (worker.joinable()) worker.join();
+}
+
+inline void Telemetry::Publish(TelemetryRecord r) {
+    if (!channel || !channel->running) return;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    r.seq = seq++;
+    r.dtUs = std::chrono::duration_cast<std::chrono::microseconds>(now - last).count();
+    last = now;
+    channel->records.Push(r);
+}
+
+inline void Telemetry::Run(std::shared_ptr<Channel> c) {
+    bool connected = false;
+    std::chrono::steady_clock::time_point nextTry = std::chrono::steady_clock::now();
+    while (c->running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(c->batchMs));
+        if (!connected && std::chrono::steady_clock::now() >= nextTry) {
+            {
+                std::lock_guard<std::mutex> lock(c->m);
+                if (!c->running) break;
+                c->connecting = true;
+            }
+            connected = connect_to_server(c->address, c->port) == 0;
+            {
+                std::lock_guard<std::mutex> lock(c->m);
+                c->connecting = false;
+            }
+            if (!connected) nextTry = std::chrono::steady_clock::now() + std::chrono::milliseconds(c->retryMs);
+        }
+        c->records.Drain([&c, &connected, &nextTry](const TelemetryRecord& r) {
+            if (!connected) {
+                c->unsent++;
+                return;
+            }
+            char message[TELEMETRY_SIZE];
+            PackTelemetry(r, message);
+            if (send_to_server(message) == 0) {
+                c->sent++;
+                return;
+            }
+            c->unsent++;
+            connected = false; // connect again after retryMs
+            nextTry = std::chrono::steady_clock::now() + std::chrono::milliseconds(c->retryMs);
+        });
+    }
+}
+
+#endif
@@ -0,0 +1,77 @@
+/*Stand-in for the server a rig sends its
+ * telemetry to (telemetry.h), for watching
+ * a tracker from a PC. Linux only.
+ * Compile: g++ -o telemetryServer telemetryServer.cpp
+ * Run: ./telemetryServer [port] */
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "telemetry.h"
+
+int port = 1024;
+double fixScale = 256.0; // centre and pose are fixed point, 8 fractional bits
+
+const char* stateNames[] = {"tracking", "local search", "scanning"};
+
+// reads one whole message, false once the rig hangs up
+bool ReadMessage(int fd, char message[TELEMETRY_SIZE]) {
+    int got = 0;
+    while (got < TELEMETRY_SIZE) {
+        int n = read(fd, message + got, TELEMETRY_SIZE - got);
+        if (n <= 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+void Serve(int fd) {
+    char message[TELEMETRY_SIZE];
+    TelemetryRecord r;
+    long received = 0;
+    long missed = 0;
+    int nextSeq = -1;
+    while (ReadMessage(fd, message)) {
+        UnpackTelemetry(message, r);
+        received++;
+        if (nextSeq >= 0) missed += (uint16_t)(r.seq - nextSeq);
+        nextSeq = (uint16_t)(r.seq + 1);
+        printf("#%u +%.1fms %s centre: %.2f %.2f radius: %u votes: %u pose: %.2f %.2f %s\n",
+               r.seq, r.dtUs/1000.0, r.found ? "found" : "lost ",
+               r.centreX/fixScale, r.centreY/fixScale, r.radius, r.votes,
+               r.azimuth/fixScale, r.elevation/fixScale,
+               r.state < 3 ? stateNames[r.state] : "?");
+        fflush(stdout);
+    }
+    printf("Rig hung up: %ld records, %ld missed\n", received, missed);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) port = atoi(argv[1]);
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    if (server < 0) {
+        perror("socket");
+        return 1;
+    }
+    int on = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(server, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(server, 1) < 0) {
+        perror("bind");
+        return 1;
+    }
+    printf("Waiting for a rig on port %d\n", port);
+    while (true) {
+        int fd = accept(server, nullptr, nullptr);
+        if (fd < 0) continue;
+        printf("Rig connected\n");
+        Serve(fd);
+        close(fd);
+    }
+    return 0;
+}
@@ -0,0 +1,192 @@
+/*Finds the cheapest detector settings that
+ * still get a labelled set of frames right,
+ * and saves them for the tracker to load.
+ * Each line of the labels file is a PPM and
+ * where the sun is in it, or none:
+ *   aSun.ppm 159 117 40   (centre x y, radius)
+ *   aMars.ppm none
+ * Compile: g++ -O2 -pthread -o tuner tuner.cpp
+ * Run: ./tuner labels.txt [accuracy] [detector.txt]
+ * A colours.txt from colourMaker.cpp is used if
+ * there is one, as the tracker does. */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define CAMERA_WIDTH 320 //Control Resolution from Camera
+#define CAMERA_HEIGHT 240 //Control Resolution from Camera
+#include "sunDetector.h"
+#include "ppm.h"
+
+double accuracy = 0.9; // fraction of the frames the settings must get right
+const char* settingsFile = "detector.txt";
+double centreTolerance = 4.0; // pixels between the found centre and the label
+double radiusTolerance = 0.2; // of the labelled radius
+int repeats = 3; // each frame is timed this many times, the fastest counts
+int firstRung = 2; // frames every candidate is tried on before the slow ones are dropped
+int minKeep = 8; // candidates kept however many rungs go by
+
+// the values tried, every combination of them
+double convThresholds[] = {45, 55, 65, 75, 90};
+int radiusRanges[] = {0, 3, 5, 8}; // 0 sizes it from the radius, as the tracker does by default
+int degSteps[] = {9, 12, 15, 20, 30};
+int voteThrs[] = {6, 10, 15, 20, 30};
+int smoothings[] = {SMOOTH_NONE, SMOOTH_BOX};
+
+SunDetector sun;
+
+struct Candidate {
+    double convThreshold;
+    int radiusRange, degStep, voteThr, smoothing;
+    int tried = 0; // frames so far, in order
+    int wrong = 0;
+    double ms = 0;
+
+    double Cost() const { return tried ? ms/tried : 0; }
+};
+
+// the frames in the order they're tried, suns and no suns taking turns so the first rungs
+// have some of each
+bool ReadFrames(const char* fn, std::vector<LabelledFrame>& frames) {
+    std::vector<LabelledFrame> labelled;
+    if (!ReadLabels(fn, labelled)) return false;
+    std::vector<LabelledFrame> suns;
+    std::vector<LabelledFrame> others;
+    for (const LabelledFrame& frame : labelled) {
+        if (frame.width != CAMERA_WIDTH || frame.height != CAMERA_HEIGHT) {
+            printf("'%s' is %dx%d, not %dx%d\n", frame.name.c_str(), frame.width, frame.height, CAMERA_WIDTH, CAMERA_HEIGHT);
+            continue;
+        }
+        (frame.sun ? suns : others).push_back(frame);
+    }
+    for (size_t i = 0; i < suns.size() || i < others.size(); i++) {
+        if (i < suns.size()) frames.push_back(suns[i]);
+        if (i < others.size()) frames.push_back(others[i]);
+    }
+    return true;
+}
+
+void Apply(const Candidate& c) {
+    sun.convThreshold = c.convThreshold;
+    sun.radiusRange = c.radiusRange;
+    sun.degStep = c.degStep;
+    sun.voteThr = c.voteThr;
+    sun.smoothing = c.smoothing;
+}
+
+// detects one more frame with the candidate's settings
+void Try(Candidate& c, const LabelledFrame& frame) {
+    Apply(c);
+    double best = 1e9;
+    bool found = false;
+    for (int i = 0; i < repeats; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        found = sun.Detect(frame.pixels.data());
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (ms < best) best = ms;
+    }
+    bool right = !found;
+    if (frame.sun && found) {
+        double dx = sun.centreX/(double)(1 << SUBPIXEL_BITS) - frame.x;
+        double dy = sun.centreY/(double)(1 << SUBPIXEL_BITS) - frame.y;
+        right = dx*dx + dy*dy <= centreTolerance*centreTolerance
+                && fabs(sun.radius - frame.radius) <= radiusTolerance*frame.radius + 1;
+    }
+    c.tried++;
+    c.wrong += !right;
+    c.ms += best;
+}
+
+void Print(const char* what, const Candidate& c) {
+    printf("%s: convThreshold %g radiusRange %d degStep %d voteThr %d smoothing %d, %d/%d right, %.2fms/frame\n",
+           what, c.convThreshold, c.radiusRange, c.degStep, c.voteThr, c.smoothing,
+           c.tried - c.wrong, c.tried, c.Cost());
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s labels.txt [accuracy] [detector.txt]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2) accuracy = atof(argv[2]);
+    if (argc > 3) settingsFile = argv[3];
+    Logger::Global().level = LEVEL_INFO; // not why each candidate failed
+    if (sun.colours.Load("colours.txt")) printf("Loaded colour table from colours.txt\n");
+    std::vector<LabelledFrame> frames;
+    if (!ReadFrames(argv[1], frames)) return 1;
+    int n = frames.size();
+    if (n == 0) {
+        printf("No frames to tune on\n");
+        return 1;
+    }
+    int allowed = n - (int)ceil(accuracy*n - 1e-9); // wrong frames the settings may have
+    std::vector<Candidate> alive;
+    for (double convThreshold : convThresholds) {
+        for (int radiusRange : radiusRanges) {
+            for (int degStep : degSteps) {
+                for (int voteThr : voteThrs) {
+                    for (int smoothing : smoothings) {
+                        Candidate c;
+                        c.convThreshold = convThreshold;
+                        c.radiusRange = radiusRange;
+                        c.degStep = degStep;
+                        c.voteThr = voteThr;
+                        c.smoothing = smoothing;
+                        alive.push_back(c);
+                    }
+                }
+            }
+        }
+    }
+    int total = alive.size();
+    printf("%d frames, %d candidates, at most %d wrong\n", n, total, allowed);
+
+    // Successive halving: every candidate tries the first few frames, any with more wrong
+    // than allowed is out for good, and the slower half of the rest is dropped. The frames
+    // double each rung, so most of the time goes on the few fast candidates left.
+    long detections = 0;
+    int rung = firstRung < n ? firstRung : n;
+    while (true) {
+        for (Candidate& c : alive) {
+            while (c.tried < rung) {
+                Try(c, frames[c.tried]);
+                detections++;
+            }
+        }
+        alive.erase(std::remove_if(alive.begin(), alive.end(), [allowed](const Candidate& c) {
+            return c.wrong > allowed;
+        }), alive.end());
+        std::sort(alive.begin(), alive.end(), [](const Candidate& a, const Candidate& b) {
+            return a.Cost() < b.Cost();
+        });
+        printf("%d frames: %d candidates left\n", rung, (int)alive.size());
+        if (rung == n || alive.empty()) break;
+        int keep = (int)alive.size()/2 > minKeep ? alive.size()/2 : minKeep;
+        if ((int)alive.size() > keep) alive.resize(keep);
+        rung = rung*2 < n ? rung*2 : n;
+    }
+    printf("%ld detections, against %ld for trying everything on every frame\n", detections, (long)total*n);
+
+    Candidate defaults; // what main.cpp has
+    defaults.convThreshold = 65.0;
+    defaults.radiusRange = 0;
+    defaults.degStep = 10;
+    defaults.voteThr = 10;
+    defaults.smoothing = SMOOTH_NONE;
+    for (const LabelledFrame& frame : frames) Try(defaults, frame);
+    Print("Defaults", defaults);
+    if (alive.empty()) {
+        printf("Nothing got %.0f%% of the frames right, try a lower accuracy\n", accuracy*100);
+        return 1;
+    }
+    Print("Fastest", alive[0]);
+    Apply(alive[0]);
+    if (!sun.SaveSettings(settingsFile)) return 1;
+    printf("Saved settings to %s\n", settingsFile);
+    return 0;
+}
@@ -0,0 +1,147 @@
+// DreamTrack
+// by the Tuff Dreamerz
+//
+// Work-stealing thread pool that runs several tracker heads in one process (main.cpp).
+// Each worker has its own queue and runs it in order; a worker whose queue is empty steals
+// from the back of another's. A head queues its next frame behind whatever its worker
+// already has, so heads take turns on a core, and spread out over every core as soon as
+// one runs dry, rather than each head keeping a whole core for its own busy loop.
+
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkPool {
+public:
+    typedef std::function<void()> Task;
+
+    // run by each worker as it starts, with its index, before any task; set before Start()
+    std::function<void(int)> onStart;
+
+    // threads workers, 0 for one per core
+    void Start(int threads);
+    // waits for the tasks that are running; queued ones are dropped
+    void Stop();
+    ~WorkPool() { Stop(); }
+
+    // from a worker onto its own queue, from any other thread onto the next worker's
+    void Submit(Task task);
+
+    int Size() const { return workers.size(); }
+    pthread_t NativeHandle(int i) { return workers[i]->thread.native_handle(); }
+    long Steals() const { return steals; }
+
+private:
+    struct Worker {
+        std::mutex m;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::mutex m; // guards queued and running, for sleeping workers
+    std::condition_variable cv;
+    int queued = 0;
+    bool running = false;
+    std::atomic<unsigned> next{0};
+    std::atomic<long> steals{0};
+
+    // the pool and worker the calling thread is, if any
+    struct Self {
+        WorkPool* pool;
+        int index;
+    };
+    static Self& This() {
+        thread_local Self self = {nullptr, -1};
+        return self;
+    }
+
+    bool Take(int self, Task& task);
+    void Run(int self);
+};
+
+inline void WorkPool::Start(int threads) {
+    if (running) return;
+    if (threads <= 0) threads = std::thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+    running = true;
+    for (int i = 0; i < threads; i++) workers.emplace_back(new Worker);
+    for (int i = 0; i < threads; i++) workers[i]->thread = std::thread(&WorkPool::Run, this, i);
+}
+
+inline void WorkPool::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (!running) return;
+        running = false;
+    }
+    cv.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (workers[i]->thread.joinable()) workers[i]->thread.join();
+    }
+    workers.clear();
+}
+
+inline void WorkPool::Submit(Task task) {
+    Self& self = This();
+    int w = self.pool == this ? self.index : next++ % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[w]->m);
+        workers[w]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m);
+        queued++;
+    }
+    cv.notify_one();
+}
+
+// own queue from the front, then anyone else's from the back
+inline bool WorkPool::Take(int self, Task& task) {
+    int n = workers.size();
+    for (int i = 0; i < n; i++) {
+        Worker& w = *workers[(self + i) % n];
+        std::lock_guard<std::mutex> lock(w.m);
+        if (w.tasks.empty()) continue;
+        if (i == 0) {
+            task = std::move(w.tasks.front());
+            w.tasks.pop_front();
+        } else {
+            task = std::move(w.tasks.back());
+            w.tasks.pop_back();
+            steals++;
+        }
+        return true;
+    }
+    return false;
+}
+
+inline void WorkPool::Run(int self) {
+    This().pool = this;
+    This().index = self;
+    if (onStart) onStart(self);
+    Task task;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [this] { return queued > 0 || !running; });
+            if (!running) return;
+        }
+        if (!Take(self, task)) continue; // another worker got there first
+        {
+            std::lock_guard<std::mutex> lock(m);
+            queued--;
+        }
+        task();
+        task = nullptr;
+    }
+}
+
+#endif